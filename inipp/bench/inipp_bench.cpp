@@ -0,0 +1,521 @@
+﻿#include "stdafx.h"
+#include <utility/ini_parser.h>
+#include <utility/ini_parser_readers.h>
+#include <utility/variant.h>
+#include <utility/json.h>
+#include <utility/robin_hood.h>
+#include <map>
+
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+// Standalone benchmark for INIpp parser. Runs every file from performance corpus through separate
+// parsing stages and reports median/p95 time, allocations and peak RSS for each of them.
+//
+// Build with “make bench” from repository root (see Makefile for dependencies). Run from “tests” directory:
+//   ../../build/inipp_bench --corpus=performance --runs=100 --output=bench.json
+// To see what reparsing saves after one include changes:
+//   ../../build/inipp_bench --corpus=performance --reparse=performance/common/materials_track.ini
+
+static std::atomic<uint64_t> alloc_count{};
+static std::atomic<uint64_t> alloc_bytes{};
+
+void* operator new(size_t size)
+{
+	alloc_count.fetch_add(1, std::memory_order_relaxed);
+	alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+	if (const auto ret = std::malloc(size ? size : 1)) return ret;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+
+namespace
+{
+	struct quiet_handler : utils::ini_parser_error_handler
+	{
+		long errors{};
+		long warnings{};
+		void on_error(const utils::path& filename, const char* message) override { ++errors; }
+		void on_warning(const utils::path& filename, const char* message) override { ++warnings; }
+	};
+
+	enum class phase
+	{
+		parse,
+		finalize,
+		to_ini,
+		to_json,
+		count
+	};
+
+	const char* phase_name(phase p)
+	{
+		switch (p)
+		{
+			case phase::parse: return "parse";
+			case phase::finalize: return "finalize";
+			case phase::to_ini: return "to_ini";
+			case phase::to_json: return "to_json";
+			default: return "?";
+		}
+	}
+
+	struct phase_sample
+	{
+		uint64_t time_ns;
+		uint64_t allocations;
+		uint64_t allocated_bytes;
+		uint64_t peak_rss_kb;
+	};
+
+	// Peak RSS is per-process, so before each phase it’s reset (Linux 4.0+) and then read back from VmHWM
+	void reset_peak_rss()
+	{
+		#ifdef __linux__
+		std::ofstream("/proc/self/clear_refs") << "5";
+		#endif
+	}
+
+	uint64_t read_peak_rss_kb()
+	{
+		#ifdef __linux__
+		std::ifstream status("/proc/self/status");
+		for (std::string line; std::getline(status, line);)
+		{
+			if (line.rfind("VmHWM:", 0) == 0)
+			{
+				return std::strtoull(line.c_str() + 6, nullptr, 10);
+			}
+		}
+		rusage usage{};
+		getrusage(RUSAGE_SELF, &usage);
+		return uint64_t(usage.ru_maxrss);
+		#else
+		return 0;
+		#endif
+	}
+
+	struct phase_meter
+	{
+		phase_sample& dest;
+		std::chrono::steady_clock::time_point start;
+		uint64_t count_start;
+		uint64_t bytes_start;
+
+		explicit phase_meter(phase_sample& dest)
+			: dest(dest)
+		{
+			reset_peak_rss();
+			count_start = alloc_count.load(std::memory_order_relaxed);
+			bytes_start = alloc_bytes.load(std::memory_order_relaxed);
+			start = std::chrono::steady_clock::now();
+		}
+
+		~phase_meter()
+		{
+			const auto end = std::chrono::steady_clock::now();
+			dest.time_ns = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+			dest.allocations = alloc_count.load(std::memory_order_relaxed) - count_start;
+			dest.allocated_bytes = alloc_bytes.load(std::memory_order_relaxed) - bytes_start;
+			dest.peak_rss_kb = read_peak_rss_kb();
+		}
+	};
+
+	using run_samples = std::array<phase_sample, size_t(phase::count)>;
+
+	run_samples run_once(const utils::path& filename, utils::ini_parser_reader& reader, quiet_handler& handler, utils::ini_parser_stats* stats,
+		utils::ini_parser_include_cache* include_cache, utils::ini_parser_lua_pool* lua_pool, utils::ini_parser_path_cache* path_cache, bool prefetch,
+		bool arena)
+	{
+		run_samples s{};
+		const utils::ini_parser::serializer_params params{.excessive_quotes = true};
+		utils::ini_parser parser(true, {});
+		parser.allow_lua(true).set_reader(&reader).set_error_handler(&handler).set_stats_sink(stats).set_include_cache(include_cache)
+			.set_lua_pool(lua_pool).set_path_cache(path_cache).prefetch_includes(prefetch).use_arena(arena);
+
+		{
+			phase_meter m(s[size_t(phase::parse)]);
+			parser.parse_file(filename);
+		}
+		{
+			phase_meter m(s[size_t(phase::finalize)]);
+			parser.finalize();
+		}
+		{
+			phase_meter m(s[size_t(phase::to_ini)]);
+			if (parser.to_ini(params).empty()) throw std::runtime_error("Unexpected empty INI output");
+		}
+		{
+			phase_meter m(s[size_t(phase::to_json)]);
+			if (parser.to_json(params).empty()) throw std::runtime_error("Unexpected empty JSON output");
+		}
+		return s;
+	}
+
+	uint64_t percentile(std::vector<uint64_t> values, double p)
+	{
+		if (values.empty()) return 0;
+		std::ranges::sort(values);
+		const auto index = size_t(std::ceil(p * double(values.size()))) - 1;
+		return values[std::min(index, values.size() - 1)];
+	}
+
+	// Time from creating a parser to having its first Lua expression evaluated and parser destroyed, which is what
+	// batch processing of small files mostly pays for. Returns median and 95th percentile.
+	std::pair<uint64_t, uint64_t> measure_lua_startup(int runs, utils::ini_parser_lua_pool* pool)
+	{
+		static const std::string data = "[STARTUP]\nVALUE = $\" 'value ' .. 1 \"\n";
+		quiet_handler handler;
+		std::vector<uint64_t> times;
+		times.reserve(runs);
+		for (auto i = 0; i < runs; i++)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			{
+				utils::ini_parser parser;
+				parser.allow_lua(true).set_error_handler(&handler).set_lua_pool(pool);
+				parser.parse(data);
+			}
+			const auto end = std::chrono::steady_clock::now();
+			times.push_back(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+		}
+		return {percentile(times, 0.5), percentile(times, 0.95)};
+	}
+
+	// Median time to parse and finalize file with a new parser, and to reparse and finalize it with the same parser
+	// after one of files it includes changed
+	std::pair<uint64_t, uint64_t> measure_reparse(const utils::path& filename, const utils::path& changed, utils::ini_parser_reader& reader,
+		int runs, int warmup)
+	{
+		quiet_handler handler;
+		const auto elapsed = [](std::chrono::steady_clock::time_point start)
+		{
+			return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		};
+
+		std::vector<uint64_t> full;
+		full.reserve(runs);
+		for (auto i = 0; i < runs; i++)
+		{
+			utils::ini_parser parser(true, {});
+			parser.allow_lua(true).set_reader(&reader).set_error_handler(&handler);
+			const auto start = std::chrono::steady_clock::now();
+			parser.parse_file(filename).finalize();
+			full.push_back(elapsed(start));
+		}
+
+		std::vector<uint64_t> partial;
+		partial.reserve(runs);
+		utils::ini_parser parser(true, {});
+		parser.allow_lua(true).set_reader(&reader).set_error_handler(&handler).enable_reparse();
+		parser.parse_file(filename).finalize();
+		for (auto i = 0; i < warmup; i++) parser.reparse({changed}).finalize();
+		for (auto i = 0; i < runs; i++)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			parser.reparse({changed}).finalize();
+			partial.push_back(elapsed(start));
+		}
+		return {percentile(full, 0.5), percentile(partial, 0.5)};
+	}
+
+	// Storage of creating_section inside parser: values kept sorted by key in a vector, inserted in place
+	struct sorted_section
+	{
+		using item = std::pair<std::string, utils::variant>;
+		std::vector<item> values;
+
+		utils::variant& get(const std::string& key)
+		{
+			const auto i = std::ranges::lower_bound(values, key, {}, &item::first);
+			if (i != values.end() && i->first == key) return i->second;
+			return values.insert(i, item{key, utils::variant{}})->second;
+		}
+
+		bool contains(const std::string& key) const
+		{
+			const auto i = std::ranges::lower_bound(values, key, {}, &item::first);
+			return i != values.end() && i->first == key;
+		}
+	};
+
+	utils::variant& section_get(std::map<std::string, utils::variant>& s, const std::string& key) { return s[key]; }
+	utils::variant& section_get(sorted_section& s, const std::string& key) { return s.get(key); }
+	bool section_contains(const std::map<std::string, utils::variant>& s, const std::string& key) { return s.find(key) != s.end(); }
+	bool section_contains(const sorted_section& s, const std::string& key) { return s.contains(key); }
+
+	// Median time and allocations to fill every resulting section value by value and to look each value up again,
+	// to compare storage of creating_section with std::map it used before
+	template <typename Section>
+	std::pair<uint64_t, uint64_t> measure_section_storage(const std::vector<utils::ini_parser::section>& sections, int runs)
+	{
+		std::vector<uint64_t> times;
+		std::vector<uint64_t> allocations;
+		times.reserve(runs);
+		allocations.reserve(runs);
+		size_t found{};
+		for (auto i = 0; i < runs; i++)
+		{
+			const auto allocations_before = alloc_count.load(std::memory_order_relaxed);
+			const auto start = std::chrono::steady_clock::now();
+			for (const auto& section : sections)
+			{
+				Section s;
+				for (const auto& v : section) section_get(s, v.first) = v.second;
+				for (const auto& v : section) found += section_contains(s, v.first);
+			}
+			const auto end = std::chrono::steady_clock::now();
+			times.push_back(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+			allocations.push_back(alloc_count.load(std::memory_order_relaxed) - allocations_before);
+		}
+		if (found == 0 && !sections.empty() && !sections[0].empty()) throw std::runtime_error("Values went missing");
+		return {percentile(times, 0.5), percentile(allocations, 0.5)};
+	}
+
+	std::vector<uint64_t> collect(const std::vector<run_samples>& runs, phase p, uint64_t phase_sample::* field)
+	{
+		std::vector<uint64_t> ret;
+		ret.reserve(runs.size());
+		for (const auto& r : runs)
+		{
+			ret.push_back(r[size_t(p)].*field);
+		}
+		return ret;
+	}
+
+	nlohmann::json summarize(const std::vector<run_samples>& runs, phase p, double file_size)
+	{
+		const auto times = collect(runs, p, &phase_sample::time_ns);
+		const auto peak_rss = collect(runs, p, &phase_sample::peak_rss_kb);
+		const auto median_ns = percentile(times, 0.5);
+		auto ret = nlohmann::json::object();
+		ret["median_ns"] = median_ns;
+		ret["p95_ns"] = percentile(times, 0.95);
+		ret["allocations"] = percentile(collect(runs, p, &phase_sample::allocations), 0.5);
+		ret["allocated_bytes"] = percentile(collect(runs, p, &phase_sample::allocated_bytes), 0.5);
+		ret["peak_rss_kb"] = peak_rss.empty() ? 0 : *std::ranges::max_element(peak_rss);
+		ret["mb_per_s"] = median_ns ? file_size / 1024. / 1024. / (double(median_ns) / 1e9) : 0.;
+		return ret;
+	}
+
+	void show_usage()
+	{
+		std::cerr << "Usage: inipp_bench [OPTION]...\n"
+			<< "Measure INIpp parser performance on a corpus of files.\n\n"
+			<< "Options:\n"
+			<< "      --corpus=DIR     directory with NN_*.ini files (default: performance)\n"
+			<< "      --runs=N         measured runs per file (default: 100)\n"
+			<< "      --warmup=N       runs to discard before measuring (default: 5)\n"
+			<< "      --label=TEXT     label stored in report, for example commit hash\n"
+			<< "      --output=FILE    write JSON report to FILE instead of STDOUT\n"
+			<< "      --stats          add parser’s own per-phase breakdown to report\n"
+			<< "      --mapped         read files with memory-mapping reader instead of caching one\n"
+			<< "      --include-cache  share parsed includes between runs\n"
+			<< "      --lua-pool       reuse Lua states between runs\n"
+			<< "      --path-cache     share directory listings used to find included files between runs\n"
+			<< "      --prefetch       read included files on background threads as soon as they are lexed\n"
+			<< "      --arena          allocate sections being parsed from per-parser arena and reuse variable scopes\n"
+			<< "      --section-storage\n"
+			<< "                       also compare sorted vector storing section values with std::map\n"
+			<< "      --reparse=FILE   also compare full parse with reparse after FILE, included by corpus files, changed\n";
+	}
+}
+
+int main(int argc, const char* argv[])
+{
+	std::string corpus = "performance";
+	std::string label;
+	std::string output;
+	auto runs = 100;
+	auto warmup = 5;
+	auto collect_stats = false;
+	auto mapped = false;
+	auto use_include_cache = false;
+	auto use_lua_pool = false;
+	auto use_path_cache = false;
+	auto prefetch = false;
+	auto use_arena = false;
+	auto section_storage = false;
+	std::string reparse_changed;
+
+	for (auto i = 1; i < argc; i++)
+	{
+		const auto arg = std::string(argv[i]);
+		const auto value = arg.substr(arg.find_first_of('=') + 1);
+		if (arg == "-h" || arg == "--help")
+		{
+			show_usage();
+			return 0;
+		}
+		if (arg.find("--corpus=") == 0) corpus = value;
+		else if (arg.find("--runs=") == 0) runs = std::max(1, std::stoi(value));
+		else if (arg.find("--warmup=") == 0) warmup = std::max(0, std::stoi(value));
+		else if (arg.find("--label=") == 0) label = value;
+		else if (arg.find("--output=") == 0) output = value;
+		else if (arg == "--stats") collect_stats = true;
+		else if (arg == "--mapped") mapped = true;
+		else if (arg == "--include-cache") use_include_cache = true;
+		else if (arg == "--lua-pool") use_lua_pool = true;
+		else if (arg == "--path-cache") use_path_cache = true;
+		else if (arg == "--prefetch") prefetch = true;
+		else if (arg == "--arena") use_arena = true;
+		else if (arg == "--section-storage") section_storage = true;
+		else if (arg.find("--reparse=") == 0) reparse_changed = value;
+		else
+		{
+			show_usage();
+			return 1;
+		}
+	}
+
+	std::vector<std::filesystem::path> inputs;
+	for (const auto& entry : std::filesystem::directory_iterator(corpus))
+	{
+		const auto name = entry.path().filename().string();
+		if (entry.path().extension() == ".ini" && name.find("__") == std::string::npos && name.size() > 3 && name[2] == '_')
+		{
+			inputs.push_back(entry.path());
+		}
+	}
+	std::ranges::sort(inputs);
+
+	auto report = nlohmann::json::object();
+	report["label"] = label;
+	report["runs"] = runs;
+	report["warmup"] = warmup;
+	report["reader"] = mapped ? "mapped" : "caching";
+	report["include_cache"] = use_include_cache;
+	report["lua_pool"] = use_lua_pool;
+	report["path_cache"] = use_path_cache;
+	report["prefetch"] = prefetch;
+	report["arena"] = use_arena;
+	report["section_storage"] = section_storage;
+	report["reparse_changed"] = reparse_changed;
+
+	{
+		std::cerr << "• Lua startup… ";
+		utils::ini_parser_lua_pool startup_pool;
+		const auto fresh = measure_lua_startup(runs, nullptr);
+		measure_lua_startup(warmup + 1, &startup_pool);
+		const auto pooled = measure_lua_startup(runs, &startup_pool);
+		auto& startup = report["lua_startup"] = nlohmann::json::object();
+		startup["fresh_median_ns"] = fresh.first;
+		startup["fresh_p95_ns"] = fresh.second;
+		startup["pooled_median_ns"] = pooled.first;
+		startup["pooled_p95_ns"] = pooled.second;
+		std::cerr << std::fixed << std::setprecision(3) << double(fresh.first) / 1e3 << " µs fresh, "
+			<< double(pooled.first) / 1e3 << " µs pooled\n";
+	}
+	auto& files = report["files"] = nlohmann::json::array();
+
+	for (const auto& input : inputs)
+	{
+		const auto filename = utils::path(input.string());
+		const auto file_size = double(std::filesystem::file_size(input));
+		utils::ini_parser_caching_reader caching_reader;
+		utils::ini_parser_mapped_reader mapped_reader;
+		auto& reader = mapped ? (utils::ini_parser_reader&)mapped_reader : caching_reader;
+		utils::ini_parser_include_cache include_cache;
+		const auto include_cache_ptr = use_include_cache ? &include_cache : nullptr;
+		utils::ini_parser_lua_pool lua_pool;
+		const auto lua_pool_ptr = use_lua_pool ? &lua_pool : nullptr;
+		utils::ini_parser_path_cache path_cache;
+		const auto path_cache_ptr = use_path_cache ? &path_cache : nullptr;
+		quiet_handler handler;
+
+		std::cerr << "• " << input.filename().string() << "… ";
+		for (auto i = 0; i < warmup; i++) run_once(filename, reader, handler, nullptr, include_cache_ptr, lua_pool_ptr, path_cache_ptr, prefetch, use_arena);
+
+		utils::ini_parser_stats stats;
+		std::vector<run_samples> samples;
+		samples.reserve(runs);
+		for (auto i = 0; i < runs; i++) samples.push_back(run_once(filename, reader, handler, collect_stats ? &stats : nullptr, include_cache_ptr,
+			lua_pool_ptr, path_cache_ptr, prefetch, use_arena));
+
+		auto file = nlohmann::json::object();
+		file["name"] = input.filename().string();
+		file["size"] = uint64_t(file_size);
+		file["errors"] = int64_t(handler.errors);
+		file["warnings"] = int64_t(handler.warnings);
+		if (use_include_cache)
+		{
+			file["include_cache_hits"] = uint64_t(include_cache.hits());
+			file["include_cache_misses"] = uint64_t(include_cache.misses());
+		}
+		if (use_lua_pool)
+		{
+			file["lua_states_created"] = uint64_t(lua_pool.created());
+			file["lua_states_reused"] = uint64_t(lua_pool.reused());
+		}
+		if (use_path_cache)
+		{
+			file["path_cache_hits"] = uint64_t(path_cache.hits());
+			file["path_cache_listed_directories"] = uint64_t(path_cache.listed_directories());
+		}
+		auto& phases = file["phases"] = nlohmann::json::object();
+		for (auto p = 0; p < int(phase::count); p++)
+		{
+			phases[phase_name(phase(p))] = summarize(samples, phase(p), file_size);
+		}
+
+		if (collect_stats)
+		{
+			auto& parser_phases = file["parser_phases"] = nlohmann::json::object();
+			for (auto p = 0; p < utils::ini_parser_stats::phases_count; p++)
+			{
+				const auto& c = stats.phases[p];
+				auto& item = parser_phases[utils::ini_parser_stats::phase_name(p)] = nlohmann::json::object();
+				item["calls"] = c.calls / uint64_t(runs);
+				item["mean_ns"] = c.nanoseconds / uint64_t(runs);
+				item["bytes"] = c.bytes / uint64_t(runs);
+			}
+			file["lua_chunk_hits"] = stats.lua_chunk_hits / uint64_t(runs);
+			file["lua_chunk_misses"] = stats.lua_chunk_misses / uint64_t(runs);
+			file["lua_native"] = stats.lua_native / uint64_t(runs);
+			file["lua_cpu_ns"] = stats.lua_cpu_ns / uint64_t(runs);
+			file["lua_memory_peak"] = stats.lua_memory_peak;
+		}
+
+		const auto parse_ms = double(percentile(collect(samples, phase::parse, &phase_sample::time_ns), 0.5)) / 1e6;
+		std::cerr << std::fixed << std::setprecision(3) << parse_ms << " ms to parse";
+		if (section_storage)
+		{
+			utils::ini_parser parser(true, {});
+			parser.allow_lua(true).set_reader(&reader).set_error_handler(&handler).parse_file(filename).finalize();
+			std::vector<utils::ini_parser::section> sections;
+			for (const auto& p : parser.get_sections()) sections.push_back(p.second);
+			const auto map = measure_section_storage<std::map<std::string, utils::variant>>(sections, runs);
+			const auto sorted = measure_section_storage<sorted_section>(sections, runs);
+			auto& storage = file["section_storage"] = nlohmann::json::object();
+			storage["std_map_median_ns"] = map.first;
+			storage["std_map_allocations"] = map.second;
+			storage["sorted_vector_median_ns"] = sorted.first;
+			storage["sorted_vector_allocations"] = sorted.second;
+			std::cerr << ", " << double(map.first) / 1e6 << " ms with std::map, " << double(sorted.first) / 1e6 << " ms sorted";
+		}
+		if (!reparse_changed.empty())
+		{
+			const auto times = measure_reparse(filename, utils::path(reparse_changed), reader, runs, warmup);
+			auto& reparse = file["reparse"] = nlohmann::json::object();
+			reparse["full_median_ns"] = times.first;
+			reparse["reparse_median_ns"] = times.second;
+			std::cerr << ", " << double(times.first) / 1e6 << " ms full, " << double(times.second) / 1e6 << " ms to reparse";
+		}
+		std::cerr << '\n';
+		files.push_back(file);
+	}
+
+	if (output.empty()) std::cout << std::setw(2) << report << '\n';
+	else std::ofstream(output) << std::setw(2) << report << '\n';
+	return 0;
+}
@@ -1,5 +1,6 @@
 ﻿#include "stdafx.h"
 #include <utility/ini_parser.h>
+#include <utility/ini_parser_readers.h>
 #include <utility/variant.h>
 #include <filesystem>
 #include <utility/json.h>
@@ -32,6 +33,10 @@ static void show_usage(const std::string& name)
 		<< "  -f, --format               format resulting JSON\n"
 		<< "  -v, --verbose              print warnings to STDERR\n"
 		<< "  -q, --quiet                do not report any errors\n"
+		<< "      --provenance=POSTFIX   also save where each section and value came from\n"
+		<< "                             as JSON, next to output or input FILE (with\n"
+		<< "                             STDIN, requires destination)\n"
+		<< "      --prefetch             read included files on background threads\n"
 		<< "      --no-include           disable includes support\n"
 		<< "      --no-maths             disable calculations support\n"
 		<< "  -h, --help     display this help and exit\n"
@@ -68,25 +73,6 @@ struct simple_reader : utils::ini_parser_reader
 	}
 };
 
-struct caching_reader : utils::ini_parser_reader
-{
-	robin_hood::unordered_map<std::wstring, std::string> cache;
-
-	std::string read(const utils::path& filename) const override
-	{
-		const auto filename_w = filename.wstring();
-		const auto found = cache.find(filename_w);
-		if (found != cache.end())
-		{
-			return found->second;
-		}
-
-		std::stringstream buffer;
-		buffer << std::ifstream(filename_w).rdbuf();
-		return buffer.str();
-	}
-};
-
 struct error_handler : utils::ini_parser_error_handler
 {
 	bool quiet;
@@ -132,11 +118,72 @@ static std::string serialize(const utils::ini_parser& parser, bool output_format
 #define STYLE_SUCCESS rang::fgB::green
 #define STYLE_INFO rang::fg::cyan
 
+// Included file replayed from include cache has to be parsed again once a file it includes changes
+static bool test_changed_nested_include(const utils::ini_parser_reader& reader, utils::ini_parser_include_cache& include_cache)
+{
+	const auto dir = std::filesystem::temp_directory_path() / "inipp_changed_include";
+	std::filesystem::create_directories(dir);
+	const auto write = [&](const char* name, const char* data) { std::ofstream(dir / name) << data; };
+	const auto main_file = utils::path((dir / "main.ini").native());
+	const auto value_of = [](const utils::ini_parser& parser)
+	{
+		const auto& sections = parser.get_sections();
+		const auto nested = sections.find("NESTED");
+		if (nested == sections.end()) return std::string();
+		const auto key = nested->second.find("KEY");
+		return key == nested->second.end() ? std::string() : key->second.as<std::string>();
+	};
+	const auto nested_value = [&]
+	{
+		utils::ini_parser parser(true, {});
+		return value_of(parser.set_reader(&reader).set_include_cache(&include_cache).parse_file(main_file).finalize());
+	};
+
+	write("main.ini", "[INCLUDE: outer.ini]\n");
+	write("outer.ini", "[INCLUDE: nested.ini]\n\n[OUTER]\nKEY = 1\n");
+	write("nested.ini", "[NESTED]\nKEY = 1\n");
+	const auto first = nested_value();
+	const auto hits = include_cache.hits();
+	const auto replayed = nested_value();
+	const auto replayed_hit = include_cache.hits() > hits;
+	write("nested.ini", "[NESTED]\nKEY = 2\n");
+	const auto changed = nested_value();
+
+	utils::ini_parser parser(true, {});
+	parser.set_reader(&reader).enable_reparse().parse_file(main_file).finalize();
+	write("nested.ini", "[NESTED]\nKEY = 3\n");
+	const auto reparsed = value_of(parser.reparse({utils::path((dir / "nested.ini").native())}).finalize());
+	std::filesystem::remove_all(dir);
+	return first == "1" && replayed == "1" && replayed_hit && changed == "2" && reparsed == "3";
+}
+
+// Tests 11–13 produce the same output either way, so check that include cache replays only where it should
+static bool test_include_replays(const utils::ini_parser_reader& reader, utils::ini_parser_error_handler& handler)
+{
+	auto include_cache = utils::ini_parser_include_cache();
+	const auto parse = [&](const char* name)
+	{
+		utils::ini_parser(true, {}).set_reader(&reader).set_error_handler(&handler).set_include_cache(&include_cache)
+			.parse_file(utils::path(std::string("auto/") + name)).finalize();
+		return std::make_pair(include_cache.hits(), include_cache.misses());
+	};
+	const auto different_parameters = parse("11_include with different parameters.ini");
+	const auto different_outer = parse("12_include with different outer values.ini");
+	const auto after_keys = parse("13_include after auto-increment keys.ini");
+	return different_parameters.first == 0 && different_parameters.second >= 2
+		&& different_outer.first == different_parameters.first && different_outer.second > different_parameters.second
+		&& after_keys.first > different_outer.first;
+}
+
 void do_debug_run()
 {
 	SetConsoleOutputCP(65001);
 	auto handler = error_handler(false, true);
 	auto reader = simple_reader();
+	// Shared between tests, so included files are replayed from it whenever possible
+	auto include_cache = utils::ini_parser_include_cache();
+	auto lua_pool = utils::ini_parser_lua_pool();
+	auto path_cache = utils::ini_parser_path_cache();
 	const auto terminal_good = rang::rang_implementation::supportsColor()
 		&& rang::rang_implementation::isTerminal(std::cout.rdbuf())
 		&& rang::rang_implementation::supportsAnsi(std::cout.rdbuf());
@@ -151,7 +198,8 @@ void do_debug_run()
 			if (filename.filename().string()[2] != '_') continue;
 
 			std::cout << STYLE_QUEUE << "• Testing " << filename.filename_without_extension().string().substr(3) << "… " << rang::style::reset;
-			auto data = utils::ini_parser(true, {}).allow_lua(true).set_reader(&reader).set_error_handler(&handler).parse_file(filename).finalize().to_ini(serialize_params());
+			auto data = utils::ini_parser(true, {}).allow_lua(true).set_reader(&reader).set_error_handler(&handler).set_include_cache(&include_cache)
+				.set_lua_pool(&lua_pool).set_path_cache(&path_cache).parse_file(filename).finalize().to_ini(serialize_params());
 			auto required = filename.parent_path() / filename.filename_without_extension() + "__result.ini";
 
 			if (exists(required))
@@ -176,6 +224,28 @@ void do_debug_run()
 		}
 	}
 
+	std::cout << STYLE_QUEUE << "• Testing include replays… " << rang::style::reset;
+	if (test_include_replays(reader, handler))
+	{
+		std::cout << STYLE_SUCCESS << "OK ✔" << rang::style::reset << std::endl;
+	}
+	else
+	{
+		clear = false;
+		std::cout << STYLE_ERROR << "failed ⚠" << rang::style::reset << std::endl;
+	}
+
+	std::cout << STYLE_QUEUE << "• Testing changed nested include… " << rang::style::reset;
+	if (test_changed_nested_include(reader, include_cache))
+	{
+		std::cout << STYLE_SUCCESS << "OK ✔" << rang::style::reset << std::endl;
+	}
+	else
+	{
+		clear = false;
+		std::cout << STYLE_ERROR << "failed ⚠" << rang::style::reset << std::endl;
+	}
+
 	const utils::path dev_input("dev/dev.ini");
 	if (exists(dev_input))
 	{
@@ -183,43 +253,6 @@ void do_debug_run()
 		std::cout << STYLE_QUEUE << "• Running developing input:" << rang::style::reset << std::endl;
 		std::cout << utils::ini_parser(true, {}).allow_lua(true).set_reader(&reader).set_error_handler(&handler).parse_file(dev_input).finalize().to_ini(serialize_params());
 	}
-	
-	for (const auto& entry : std::filesystem::directory_iterator("performance"))
-	{
-		if (entry.path().extension() == ".ini" && entry.path().native().find(L"__") == std::wstring::npos)
-		{
-			auto filename = utils::path(entry.path().native());
-			if (filename.filename().string()[2] != '_') continue;
-
-			const auto file_size = double(get_file_size(filename));
-
-			std::cout << STYLE_QUEUE << "• Measuring performance of " << filename.filename_without_extension().string().substr(3) << "… " << rang::style::reset;
-			caching_reader c_reader;
-			if (utils::ini_parser(true, {}).allow_lua(true).set_reader(&c_reader).set_error_handler(&handler).parse_file(filename).finalize().get_sections().empty())
-			{
-				throw std::runtime_error("Unexpected");
-			}
-
-			for (auto j = 0; j < 6; j++)
-			{
-				const auto start = std::chrono::high_resolution_clock::now();
-				const auto run_count = 100;
-				for (auto i = 0; i < run_count; i++)
-				{
-					if (utils::ini_parser(true, {}).allow_lua(true).set_reader(&c_reader).set_error_handler(&handler).parse_file(filename).finalize().get_sections().empty())
-					{
-						throw std::runtime_error("Unexpected");
-					}
-				}
-				const auto taken_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
-				const auto taken_s = double(taken_ns) / 1e9;
-				const auto speed = double(run_count) * file_size / 1024 / 1024 / taken_s;
-				std::cout << STYLE_INFO << std::fixed << std::setprecision(2) << speed << " MB/s" << rang::style::reset << " ";
-			}
-
-			std::cout << std::endl;
-		}
-	}
 
 	utils::ini_parser::leaks_check([](const char* name, long count)
 	{
@@ -242,9 +275,11 @@ int main(int argc, const char* argv[])
 	auto output_format = false;
 	auto verbose = false;
 	auto debug_run = false;
+	auto prefetch = false;
 	auto separator = std::string("\n\n");
 	std::string postfix;
 	std::string destination;
+	std::string provenance;
 	std::vector<utils::path> resolve_within;
 	std::vector<utils::path> input_files;
 
@@ -279,6 +314,8 @@ int main(int argc, const char* argv[])
 		else if (arg == "-o" || arg == "--output-ini") output_ini = true;
 		else if (arg == "-f" || arg == "--format") output_format = true;
 		else if (arg == "-v" || arg == "--verbose") verbose = true;
+		else if (arg == "--prefetch") prefetch = true;
+		else if (arg.find("--provenance=") == 0) provenance = arg.substr(arg.find_first_of('=') + 1);
 		GET_VALUE(d, destination, destination=)
 		GET_VALUE(s, separator, separator=)
 		GET_VALUE(p, postfix, postfix=)
@@ -293,25 +330,44 @@ int main(int argc, const char* argv[])
 	}
 
 	auto handler = error_handler(quiet, verbose);
-	auto reader = simple_reader();
+	utils::ini_parser_caching_reader reader;
 	if (input_files.empty())
 	{
+		if (!provenance.empty() && destination.empty())
+		{
+			std::cerr << "Provenance can only be saved next to destination FILE when reading from STDIN\n";
+			return 1;
+		}
+
 		std::istreambuf_iterator<char> begin(std::cin), end;
 		std::string s(begin, end);
-		auto processed = serialize(
-			utils::ini_parser(allow_includes, resolve_within).allow_lua(allow_lua).set_reader(&reader).set_error_handler(&handler).parse(s).finalize(),
-			output_format, output_ini);
-		if (!destination.empty()) std::ofstream(destination) << processed;
+		utils::ini_parser parser(allow_includes, resolve_within);
+		parser.allow_lua(allow_lua).set_reader(&reader).set_error_handler(&handler).record_provenance(!provenance.empty());
+		auto processed = serialize(parser.parse(s).finalize(), output_format, output_ini);
+		if (!destination.empty())
+		{
+			std::ofstream(destination) << processed;
+			if (!provenance.empty()) std::ofstream(destination + provenance) << parser.get_provenance()->to_json(output_format);
+		}
 		else std::cout << processed;
 		return handler.errors_reported ? 2 : handler.warnings_reported ? 1 : 0;
 	}
 
 	auto first = true;
+	utils::ini_parser_lua_pool lua_pool;
+	utils::ini_parser_path_cache path_cache;
 	for (const auto& f : input_files)
 	{
-		auto processed = serialize(
-			utils::ini_parser(allow_includes, resolve_within).allow_lua(allow_lua).set_reader(&reader).set_error_handler(&handler).parse_file(f).finalize(),
-			output_format, output_ini);
+		utils::ini_parser parser(allow_includes, resolve_within);
+		parser.allow_lua(allow_lua).set_reader(&reader).set_error_handler(&handler).set_lua_pool(&lua_pool)
+			.set_path_cache(&path_cache).prefetch_includes(prefetch).record_provenance(!provenance.empty());
+		auto processed = serialize(parser.parse_file(f).finalize(), output_format, output_ini);
+		if (!provenance.empty())
+		{
+			const auto sidecar = (!destination.empty() ? destination : !postfix.empty() ? f.string() + postfix : f.string()) + provenance;
+			std::ofstream(sidecar) << parser.get_provenance()->to_json(output_format);
+		}
+
 		if (!destination.empty())
 		{
 			std::ofstream(destination) << processed;
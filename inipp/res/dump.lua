@@ -0,0 +1,10 @@
+-- Compiles standard library into bytecode with string.dump(), run as `lua dump.lua std.lua std.luac`. Chunk is named
+-- the same way luaL_loadstring() names it, so error messages don't change.
+local input, output = ...
+local file = assert(io.open(input, 'rb'))
+local source = file:read('a')
+file:close()
+local fn = assert(load(source, source))
+file = assert(io.open(output, 'wb'))
+file:write(string.dump(fn))
+file:close()
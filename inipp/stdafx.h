@@ -15,7 +15,9 @@
 
 typedef unsigned char byte;
 
+#ifdef _WIN32
 #include "targetver.h"
+#endif
 
 #include <algorithm>
 #include <array>
@@ -45,7 +47,12 @@ typedef unsigned char byte;
 #include <unordered_map>
 #include <utility>
 #include <vector>
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <strings.h>
+#define _stricmp strcasecmp
+#endif
 #include <utility/helpers.h>
 #include <utility/path.h>
 #include <utility/string_codecvt.h>
@@ -1,6 +1,15 @@
 ﻿#include "stdafx.h"
 #include "ini_parser.h"
+#include "ini_parser_expressions.h"
+#include <bit>
+#include <condition_variable>
+#include <ctime>
+#include <deque>
 #include <iomanip>
+#include <list>
+#include <memory_resource>
+#include <optional>
+#include <mutex>
 #include <lua.hpp>
 #include <utility/alphanum.h>
 #include <utility/json.h>
@@ -21,64 +30,125 @@
 #define _assert(x) assert(x)
 #endif
 
+#if defined __AVX2__
+#include <immintrin.h>
+#define INIPP_SCAN_AVX2
+#elif defined __SSE2__ || defined _M_X64 || defined _M_IX86_FP && _M_IX86_FP >= 2
+#include <emmintrin.h>
+#define INIPP_SCAN_SSE2
+#endif
+
 namespace utils
 {
 	static pblob std_lib_data;
 
+	// Standard library is compiled once per process, states created afterwards load its bytecode
+	static std::mutex std_lib_mutex;
+	static std::string std_lib_bytecode;
+
+	// Replacement library might define functions differently, so expressions are not evaluated natively with it
+	static std::atomic<bool> std_lib_replaced;
+
 	void ini_parser::set_std_lib(pblob data)
 	{
+		std::unique_lock lock(std_lib_mutex);
+		std_lib_replaced = data != nullptr;
 		std_lib_data = std::move(data);
+		std_lib_bytecode.clear();
 	}
 
+	// Vector sorted by key: sections have few keys, and iteration order stays as it was with std::map
 	struct creating_section
 	{
 		typedef std::pair<std::string, variant> item;
-		std::map<std::string, variant> values;
+		using iterator = std::vector<item>::iterator;
+		using const_iterator = std::vector<item>::const_iterator;
 
 		void set(const std::string& k, variant v)
 		{
-			values[k] = std::move(v);
+			get(k) = std::move(v);
 		}
 
 		void set(const std::string& k, const str_view& v)
 		{
-			values[k] = variant(v);
+			get(k) = variant(v);
 		}
 
-		auto find(const std::string& a) const
+		const_iterator find(const std::string_view& a) const
 		{
-			return values.find(a);
+			const auto i = lower_bound(a);
+			return i != values_.end() && i->first == a ? i : values_.end();
 		}
 
-		auto end() const
+		// Unlike get(), doesn’t insert missing values, so references to other values stay valid
+		const variant& value(const std::string_view& a) const
 		{
-			return values.end();
+			static const variant empty;
+			const auto i = find(a);
+			return i != values_.end() ? i->second : empty;
 		}
 
+		// Inserting a missing value moves others, so references returned earlier can’t be kept
 		variant& get(const std::string& a)
 		{
-			return values[a];
+			fingerprint_ready_ = false;
+			const auto i = lower_bound(a);
+			if (i != values_.end() && i->first == a) return values_[size_t(i - values_.begin())].second;
+			return values_.insert(i, item{a, variant{}})->second;
+		}
+
+		void erase(const std::string_view& a)
+		{
+			if (const auto i = find(a); i != values_.end())
+			{
+				erase(i);
+			}
 		}
 
-		void erase(const std::string& a)
+		iterator erase(const_iterator i)
 		{
-			values.erase(a);
+			fingerprint_ready_ = false;
+			return values_.erase(i);
 		}
 
 		void clear()
 		{
-			values.clear();
+			fingerprint_ready_ = false;
+			values_.clear();
 		}
 
 		bool empty() const
 		{
-			return values.empty();
+			return values_.empty();
+		}
+
+		size_t size() const
+		{
+			return values_.size();
+		}
+
+		const_iterator begin() const { return values_.begin(); }
+		const_iterator end() const { return values_.end(); }
+
+		// Values can be changed through these, so cached fingerprint is reset
+		iterator begin()
+		{
+			fingerprint_ready_ = false;
+			return values_.begin();
 		}
 
+		iterator end() { return values_.end(); }
+
+		// Position of section in provenance table, if it’s being recorded
+		uint32_t origin() const { return origin_; }
+		void set_origin(uint32_t origin) { origin_ = origin; }
+
+		// Include parameters are fingerprinted for each included file, so the result is cached until next change
 		size_t fingerprint() const
 		{
+			if (fingerprint_ready_) return fingerprint_;
 			size_t ret{};
-			for (const auto& p : values)
+			for (const auto& p : values_)
 			{
 				auto r = std::hash<std::string>{}(p.first);
 				for (const auto& v : p.second)
@@ -87,8 +157,21 @@ namespace utils
 				}
 				ret ^= r;
 			}
+			fingerprint_ = ret;
+			fingerprint_ready_ = true;
 			return ret;
 		}
+
+	private:
+		std::vector<item> values_;
+		mutable size_t fingerprint_{};
+		mutable bool fingerprint_ready_{};
+		uint32_t origin_ = ini_parser_provenance::none;
+
+		const_iterator lower_bound(const std::string_view& a) const
+		{
+			return std::lower_bound(values_.begin(), values_.end(), a, [](const item& i, const std::string_view& k) { return std::string_view(i.first) < k; });
+		}
 	};
 
 	using resulting_section = robin_hood::unordered_flat_map<std::string, variant>;
@@ -146,6 +229,79 @@ namespace utils
 		return s.starts_with("data:image/png;base64,");
 	}
 
+	// Skip bytes parse_ini_values() wouldn’t react to, may stop early but never late
+
+	inline bool ends_value_run(char c)
+	{
+		return uint8_t(c) <= ' ' || c == ';' || c == '/' || c == '[' || c == '=' || c == '"' || c == '\'';
+	}
+
+	// Returns position of first byte in [from, to) which is whitespace, control character or one of `;/[="'`
+	inline int scan_value_run(const char* data, int from, const int to)
+	{
+		#if defined INIPP_SCAN_AVX2
+		const auto space = _mm256_set1_epi8(' ');
+		for (; from + 32 <= to; from += 32)
+		{
+			const auto v = _mm256_loadu_si256((const __m256i*)(data + from));
+			auto m = _mm256_cmpeq_epi8(_mm256_min_epu8(v, space), v);
+			m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')));
+			m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/')));
+			m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('[')));
+			m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('=')));
+			m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+			m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')));
+			if (const auto mask = uint32_t(_mm256_movemask_epi8(m))) return from + std::countr_zero(mask);
+		}
+		#elif defined INIPP_SCAN_SSE2
+		const auto space = _mm_set1_epi8(' ');
+		for (; from + 16 <= to; from += 16)
+		{
+			const auto v = _mm_loadu_si128((const __m128i*)(data + from));
+			auto m = _mm_cmpeq_epi8(_mm_min_epu8(v, space), v);
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(';')));
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('[')));
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('=')));
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+			if (const auto mask = uint32_t(_mm_movemask_epi8(m))) return from + std::countr_zero(mask);
+		}
+		#endif
+		for (; from < to && !ends_value_run(data[from]); ++from) {}
+		return from;
+	}
+
+	// Returns position of first whitespace or control character in [from, to), for solid values
+	inline int scan_solid_run(const char* data, int from, const int to)
+	{
+		#if defined INIPP_SCAN_AVX2
+		const auto space = _mm256_set1_epi8(' ');
+		for (; from + 32 <= to; from += 32)
+		{
+			const auto v = _mm256_loadu_si256((const __m256i*)(data + from));
+			if (const auto mask = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(v, space), v)))) return from + std::countr_zero(mask);
+		}
+		#elif defined INIPP_SCAN_SSE2
+		const auto space = _mm_set1_epi8(' ');
+		for (; from + 16 <= to; from += 16)
+		{
+			const auto v = _mm_loadu_si128((const __m128i*)(data + from));
+			if (const auto mask = uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, space), v)))) return from + std::countr_zero(mask);
+		}
+		#endif
+		for (; from < to && uint8_t(data[from]) > ' '; ++from) {}
+		return from;
+	}
+
+	// memchr() is vectorized already
+	inline int scan_char(const char* data, const int from, const int to, const char c)
+	{
+		if (from >= to) return to;
+		const auto found = (const char*)memchr(data + from, c, size_t(to - from));
+		return found ? int(found - data) : to;
+	}
+
 	inline bool is_identifier_part(char c)
 	{
 		return c == '_' || isupper(c) || islower(c) || isdigit(c);
@@ -188,118 +344,259 @@ namespace utils
 		counters = {};
 	}
 
-	struct variable_scope : std::enable_shared_from_this<variable_scope>
+	using scope_id = uint32_t;
+
+	// Explicit values remember their scope, so lookups leaving a recorded scope can be logged
+	struct lookup_step
+	{
+		const creating_section* values;
+		scope_id logged;
+	};
+
+	struct variable_scope
 	{
 		creating_section explicit_values;
 		creating_section include_params;
 		creating_section default_values;
 		const creating_section* target_section;
-		std::vector<const variable_scope*> local_fallbacks;
-		std::shared_ptr<variable_scope> parent;
+		std::vector<scope_id> local_fallbacks;
+		scope_id parent;
 
-		void fallback(const std::shared_ptr<variable_scope>& s)
-		{
-			local_fallbacks.push_back(s.get());
-		}
+		// Names of variables lookups got past this scope while included file is recorded
+		std::vector<std::string>* outer_lookups{};
 
-		std::shared_ptr<variable_scope> inherit(const creating_section* target = nullptr)
-		{
-			return std::make_shared<variable_scope>(shared_from_this(), target);
-		}
+		// Flattened lookup order, rebuilt after fallbacks of any scope change
+		mutable std::vector<lookup_step> lookup_steps;
+		mutable uint32_t targets_begin{};
+		mutable uint32_t fallbacks_begin{};
+		mutable uint32_t lookup_epoch = UINT32_MAX;
+		bool pinned{};
 
-		variable_scope()
-			: target_section(nullptr), parent(nullptr)
+		variable_scope(scope_id parent, const creating_section* target_section)
+			: target_section(target_section), parent(parent)
 		{
 			counters.variable_scope++;
 		}
 
-		variable_scope(std::shared_ptr<variable_scope> parent, const creating_section* target_section)
-			: target_section(target_section), parent(std::move(parent))
+		variable_scope(const variable_scope& other) = delete;
+		variable_scope& operator=(const variable_scope& other) = delete;
+
+		// Turns scope into a new one, with or without memory its values took
+		void reset(scope_id new_parent, const creating_section* new_target_section, bool keep_memory)
 		{
-			counters.variable_scope++;
+			if (keep_memory)
+			{
+				explicit_values.clear();
+				include_params.clear();
+				default_values.clear();
+				local_fallbacks.clear();
+				lookup_steps.clear();
+			}
+			else
+			{
+				explicit_values = {};
+				include_params = {};
+				default_values = {};
+				local_fallbacks = {};
+				lookup_steps = {};
+			}
+			target_section = new_target_section;
+			parent = new_parent;
+			outer_lookups = nullptr;
+			pinned = false;
+			targets_begin = 0;
+			fallbacks_begin = 0;
+			lookup_epoch = UINT32_MAX;
 		}
 
 		~variable_scope()
 		{
 			counters.variable_scope--;
 		}
+	};
 
-		const variant* find(const std::string& name) const
-		{
-			if (const auto ret = find_explicit(name)) return ret;
-			if (const auto ret = find_value(name)) return ret;
-			if (const auto ret = find_fallback(name)) return ret;
-			return nullptr;
-		}
+	// Scopes refer to each other by index, temporary ones are released in stack order and template ones are pinned
+	struct scope_arena
+	{
+		static constexpr scope_id none = UINT32_MAX;
 
-	private:
-		const variant* find_explicit(const std::string& name) const
+		std::deque<variable_scope> items;
+		std::vector<scope_id> created;
+		std::vector<scope_id> dropped;
+		bool recycle{};
+
+		scope_id create(scope_id parent = none, const creating_section* target_section = nullptr)
 		{
-			const auto v = explicit_values.find(name);
-			if (v != explicit_values.end())
+			scope_id ret;
+			if (!dropped.empty())
 			{
-				return &v->second;
+				ret = dropped.back();
+				dropped.pop_back();
+				items[ret].reset(parent, target_section, true);
 			}
-
-			if (const auto ret = parent ? parent->find_explicit(name) : nullptr)
+			else
 			{
-				return ret;
+				items.emplace_back(parent, target_section);
+				ret = scope_id(items.size() - 1);
 			}
+			created.push_back(ret);
+			return ret;
+		}
 
-			return nullptr;
+		size_t size() const
+		{
+			return created.size();
 		}
 
-		const variant* find_value(const std::string& name) const
+		void pin(scope_id id)
 		{
-			if (target_section != nullptr)
+			for (; id != none && !items[id].pinned; id = items[id].parent)
 			{
-				const auto v = target_section->find(name);
-				if (v != target_section->end())
-				{
-					return &v->second;
-				}
+				items[id].pinned = true;
 			}
+		}
 
-			if (const auto ret = parent ? parent->find_value(name) : nullptr)
+		void release(size_t mark)
+		{
+			while (created.size() > mark)
 			{
-				return ret;
+				const auto id = created.back();
+				created.pop_back();
+				if (items[id].pinned) continue;
+				items[id].reset(none, nullptr, recycle);
+				dropped.push_back(id);
 			}
+		}
 
-			return nullptr;
+		// Flattened lookups are only rebuilt if something was looked up already
+		void fallback(scope_id id, scope_id fallback)
+		{
+			auto& s = items[id];
+			s.local_fallbacks.push_back(fallback);
+			if (s.lookup_epoch != UINT32_MAX) ++epoch;
+		}
+
+		const variant* find(scope_id id, const std::string& name) const
+		{
+			const auto& s = flatten(id);
+			return find(s.lookup_steps.data(), s.lookup_steps.data() + s.lookup_steps.size(), name);
 		}
 
-		const variant* find_fallback(const std::string& name) const
+		// Hash of everything lookup of a name from a child scope might get from this one
+		size_t lookup_fingerprint(scope_id id, const std::string& name) const
 		{
+			const auto& s = flatten(id);
+			const auto steps = s.lookup_steps.data();
+			const auto steps_end = steps + s.lookup_steps.size();
+			size_t ret{};
+			for (const auto v : {
+				find(steps, steps + s.targets_begin, name),
+				find(steps + s.targets_begin, steps + s.fallbacks_begin, name),
+				find(steps + s.fallbacks_begin, steps_end, name)})
 			{
-				const auto v = include_params.find(name);
-				if (v != include_params.end())
+				auto r = v ? v->size() : size_t(-1);
+				if (v)
 				{
-					return &v->second;
+					for (const auto& i : *v)
+					{
+						r = (r * 397) ^ i.hash_code();
+					}
 				}
+				ret = (ret * 397) ^ r;
 			}
+			return ret;
+		}
 
-			if (const auto ret = parent ? parent->find_fallback(name) : nullptr)
-			{
-				return ret;
-			}
+	private:
+		uint32_t epoch{};
 
+		const variant* find(const lookup_step* step, const lookup_step* end, const std::string& name) const
+		{
+			for (; step != end; ++step)
 			{
-				const auto v = default_values.find(name);
-				if (v != default_values.end())
+				if (step->logged != none)
+				{
+					if (const auto log = items[step->logged].outer_lookups) log->push_back(name);
+				}
+				if (step->values->empty()) continue;
+				const auto v = step->values->find(name);
+				if (v != step->values->end())
 				{
 					return &v->second;
 				}
 			}
+			return nullptr;
+		}
 
-			for (auto f : local_fallbacks)
+		// Parents are flattened first, so their parts can simply be copied
+		const variable_scope& flatten(scope_id id) const
+		{
+			const auto& s = items[id];
+			if (s.lookup_epoch == epoch) return s;
+
+			const auto p = s.parent != none ? &flatten(s.parent) : nullptr;
+			auto& steps = s.lookup_steps;
+			steps.clear();
+			steps.push_back({&s.explicit_values, id});
+			if (p) steps.insert(steps.end(), p->lookup_steps.begin(), p->lookup_steps.begin() + p->targets_begin);
+			s.targets_begin = uint32_t(steps.size());
+			if (s.target_section) steps.push_back({s.target_section, none});
+			if (p) steps.insert(steps.end(), p->lookup_steps.begin() + p->targets_begin, p->lookup_steps.begin() + p->fallbacks_begin);
+			s.fallbacks_begin = uint32_t(steps.size());
+			steps.push_back({&s.include_params, none});
+			if (p) steps.insert(steps.end(), p->lookup_steps.begin() + p->fallbacks_begin, p->lookup_steps.end());
+			steps.push_back({&s.default_values, none});
+			for (const auto f : s.local_fallbacks)
 			{
-				if (const auto ret = f->find(name))
+				for (const auto& step : flatten(f).lookup_steps)
 				{
-					return ret;
+					if (std::ranges::find(steps.begin() + s.fallbacks_begin, steps.end(), step.values, &lookup_step::values) == steps.end())
+					{
+						steps.push_back(step);
+					}
 				}
 			}
+			s.lookup_epoch = epoch;
+			return s;
+		}
+	};
 
-			return nullptr;
+	// Drops scopes created during its lifetime once it’s gone, unless some of them were pinned
+	struct scope_release
+	{
+		scope_arena& arena;
+		size_t mark;
+
+		explicit scope_release(scope_arena& arena) : arena(arena), mark(arena.size()) {}
+		scope_release(const scope_release& other) = delete;
+		scope_release& operator=(const scope_release& other) = delete;
+		~scope_release() { arena.release(mark); }
+	};
+
+	// Handle for a scope in parser’s arena, cheap to copy around
+	struct scope_ref
+	{
+		scope_arena* arena{};
+		scope_id id{};
+
+		explicit operator bool() const { return arena != nullptr; }
+		bool operator==(const scope_ref& other) const = default;
+		variable_scope* operator->() const { return &arena->items[id]; }
+		variable_scope& operator*() const { return arena->items[id]; }
+
+		scope_ref inherit(const creating_section* target = nullptr) const
+		{
+			return {arena, arena->create(id, target)};
+		}
+
+		void fallback(const scope_ref& s) const
+		{
+			arena->fallback(id, s.id);
+		}
+
+		const variant* find(const std::string& name) const
+		{
+			return arena->find(id, name);
 		}
 	};
 
@@ -312,6 +609,9 @@ namespace utils
 	static const std::string SPECIAL_MISSING_VARIABLE = "[[SPEC:MISSING:";
 	static const std::string SPECIAL_CALCULATE = SPECIAL_CALCULATE_STR;
 	static const std::string SPECIAL_END = SPECIAL_END_STR;
+	static const std::string SPECIAL_ARGUMENT = "[[SPEC:ARG:";
+	static const std::string SPECIAL_ARGUMENT_END = "]]";
+	static const std::string SPECIAL_BATCH = "[[SPEC:BATCH:";
 
 	inline std::string wrap_special(const std::string& special, const std::string& value)
 	{
@@ -358,6 +658,16 @@ namespace utils
 		{
 			dest.push_back(prefix + (lua_toboolean(L, index) ? "1" : "0") + postfix);
 		}
+		#ifdef USE_SIMPLE
+		else if (lua_type(L, index) == LUA_TNUMBER)
+		{
+			// Saves interning a Lua string for each result
+			const auto s = lua_isinteger(L, index)
+				? ini_parser_expression::format_number(int64_t(lua_tointeger(L, index)))
+				: ini_parser_expression::format_number(double(lua_tonumber(L, index)));
+			dest.push_back(prefix.empty() && postfix.empty() ? s : prefix + s + postfix);
+		}
+		#endif
 		else
 		{
 			const auto s = lua_tolstring(L, index, nullptr);
@@ -428,75 +738,73 @@ namespace utils
 		return force_type == LUA_TTABLE ? 1 : int(v.size());
 	}
 
+	// Reflection pattern with “?” for any characters, compiled into exact, prefix, suffix, substring or glob matcher
 	struct match_string
 	{
 		match_string(const char* c)
-			: c_(c)
 		{
-			size_ = 0;
-			required_ = 0;
-			mode_ = test_mode::complete;
-			if (!c_) return;
-			for (auto i = 0U; c_[i]; ++i)
+			if (!c) return;
+
+			pattern_ = c;
+			auto mode = test_mode::complete;
+			for (auto i = 0U; i < pattern_.size(); ++i)
 			{
-				if (c_[i] == '?')
+				if (pattern_[i] != '?')
 				{
-					if (i == 0U)
-					{
-						mode_ = test_mode::ends_with;
-					}
-					else if (c_[i + 1])
-					{
-						mode_ = test_mode::pattern;
-					}
-					else if (mode_ != test_mode::pattern)
-					{
-						mode_ = mode_ == test_mode::ends_with ? test_mode::contains : test_mode::starts_with;
-					}
+					++required_;
 				}
-				else
+				else if (i == 0U)
 				{
-					++required_;
+					mode = test_mode::ends_with;
+				}
+				else if (i + 1U < pattern_.size())
+				{
+					mode = test_mode::pattern;
+				}
+				else if (mode != test_mode::pattern)
+				{
+					mode = mode == test_mode::ends_with ? test_mode::contains : test_mode::starts_with;
+				}
+			}
+
+			fuzzy_ = mode != test_mode::complete;
+			if (pattern_ == "?") return;
+
+			mode_ = mode;
+			if (mode == test_mode::pattern)
+			{
+				for (auto i = 0U;;)
+				{
+					const auto end = pattern_.find('?', i);
+					if (end == std::string::npos)
+					{
+						pieces_.push_back({i, uint32_t(pattern_.size()) - i});
+						break;
+					}
+					pieces_.push_back({i, uint32_t(end) - i});
+					i = uint32_t(end) + 1U;
 				}
-				++size_;
 			}
-			if (size_ == 1 && c_[0] == '?') c_ = nullptr;
-			else if (mode_ == test_mode::contains || mode_ == test_mode::ends_with) ++c_;
+			else
+			{
+				const auto skip = mode == test_mode::ends_with || mode == test_mode::contains ? 1U : 0U;
+				pieces_.push_back({skip, uint32_t(required_)});
+			}
 		}
 
 		bool test(const std::string& s) const
 		{
-			if (!c_) return true;
-			if (s.size() < required_) return false;
-			switch (mode_)
-			{
-				case test_mode::complete: return s.size() == required_ && memcmp(s.c_str(), c_, size_ + 1) == 0;
-				case test_mode::starts_with: return s.size() >= required_ && memcmp(s.c_str(), c_, required_) == 0;
-				case test_mode::ends_with: return s.size() >= required_ && memcmp(&s[s.size() - required_], c_, required_) == 0;
-				case test_mode::contains: return find(s);
-				case test_mode::pattern: return match_pattern(s);
-			}
-			return false;
+			return test(s.data(), s.size());
 		}
 
 		bool test(const str_view& s) const
 		{
-			if (!c_) return true;
-			if (s.size() < required_) return false;
-			switch (mode_)
-			{
-				case test_mode::complete: return s.size() == required_ && memcmp(s.data(), c_, size_ + 1) == 0;
-				case test_mode::starts_with: return s.size() >= required_ && memcmp(s.data(), c_, required_) == 0;
-				case test_mode::ends_with: return s.size() >= required_ && memcmp(&s[s.size() - required_], c_, required_) == 0;
-				case test_mode::contains: return find(s);
-				case test_mode::pattern: return match_pattern(s);
-			}
-			return false;
+			return test(s.data(), s.size());
 		}
 
 		bool test(const variant& v) const
 		{
-			if (!c_) return true;
+			if (empty()) return true;
 			for (const auto& i : v)
 			{
 				if (test(i)) return true;
@@ -504,146 +812,725 @@ namespace utils
 			return false;
 		}
 
-		bool empty() const { return !c_; }
-		bool fuzzy() const { return mode_ != test_mode::complete; }
+		bool empty() const { return mode_ == test_mode::any; }
+		bool fuzzy() const { return fuzzy_; }
+
+		const char* c_str() const { return pattern_.c_str(); }
+
+		enum class anchor
+		{
+			none,
+			exact,
+			prefix,
+			suffix
+		};
 
-		const char* c_str() const { return c_; }
+		// Part every match equals, starts or ends with, to find candidates in sorted index
+		anchor literal(std::string& ret) const
+		{
+			switch (mode_)
+			{
+				case test_mode::complete: ret.assign(piece(0), pieces_[0].size);
+					return anchor::exact;
+				case test_mode::starts_with: ret.assign(piece(0), pieces_[0].size);
+					return anchor::prefix;
+				case test_mode::ends_with: ret.assign(piece(0), pieces_[0].size);
+					return anchor::suffix;
+				case test_mode::pattern:
+				{
+					if (pieces_[0].size == 0) return anchor::none;
+					ret.assign(piece(0), pieces_[0].size);
+					return anchor::prefix;
+				}
+				default: return anchor::none;
+			}
+		}
 
 	private:
-		const char* c_;
-		size_t size_;
-		size_t required_;
 		enum class test_mode
 		{
+			any,
 			complete,
 			starts_with,
 			ends_with,
 			contains,
 			pattern
-		} mode_;
+		};
 
-		// TODO: Use better approach
-		bool find(const std::string& s) const
+		// Offsets rather than pointers, so compiled pattern could be copied around
+		struct piece_pos
 		{
-			if (s.size() < required_) return false;
-			for (auto i = 0U; i <= s.size() - required_; ++i)
-			{
-				if (memcmp(&s[i], c_, required_) == 0) return true;
-			}
-			return false;
-		}
+			uint32_t offset;
+			uint32_t size;
+		};
+
+		std::string pattern_;
+		std::vector<piece_pos> pieces_;
+		size_t required_{};
+		test_mode mode_{test_mode::any};
+		bool fuzzy_{};
 
-		bool find(const str_view& s) const
+		const char* piece(size_t i) const { return pattern_.data() + pieces_[i].offset; }
+
+		bool test(const char* s, size_t size) const
 		{
-			if (s.size() < required_) return false;
-			for (auto i = 0U; i <= s.size() - required_; ++i)
+			if (mode_ == test_mode::any) return true;
+			if (size < required_) return false;
+			switch (mode_)
 			{
-				if (memcmp(&s[i], c_, required_) == 0) return true;
+				case test_mode::complete: return size == required_ && memcmp(s, piece(0), required_) == 0;
+				case test_mode::starts_with: return memcmp(s, piece(0), required_) == 0;
+				case test_mode::ends_with: return memcmp(s + size - required_, piece(0), required_) == 0;
+				case test_mode::contains: return find(s, size, 0, piece(0), required_) != std::string::npos;
+				case test_mode::pattern: return match_pattern(s, size);
+				default: return false;
 			}
-			return false;
 		}
 
-		bool match_pattern(const std::string& candidate, uint32_t p = 0, uint32_t c = 0) const
+		static size_t find(const char* s, size_t size, size_t from, const char* piece, size_t piece_size)
 		{
-			if (p >= size_)
-			{
-				for (; c < candidate.size(); c++)
-				{
-					const auto f = candidate[c];
-					if (f != ' ' && f != '\t') return false;
-				}
-				return true;
-			}
-
-			if (c_[p] == '?')
+			if (piece_size == 0) return from;
+			while (from + piece_size <= size)
 			{
-				for (; c < candidate.size(); c++)
-				{
-					if (match_pattern(candidate, p + 1U, c)) return true;
-				}
-				return match_pattern(candidate, p + 1U, c);
+				const auto found = (const char*)memchr(s + from, piece[0], size - piece_size + 1 - from);
+				if (!found) break;
+				if (memcmp(found + 1, piece + 1, piece_size - 1) == 0) return size_t(found - s);
+				from = size_t(found - s) + 1;
 			}
-			return c_[p] == candidate[c] && match_pattern(candidate, p + 1U, c + 1U);
+			return std::string::npos;
 		}
 
-		bool match_pattern(const str_view& candidate, uint32_t p = 0, uint32_t c = 0) const
+		// Pieces between the first and the last one are matched greedily
+		bool match_pattern(const char* s, size_t size) const
 		{
-			if (p >= size_)
+			const auto& first = pieces_.front();
+			if (memcmp(s, piece(0), first.size) != 0) return false;
+
+			auto pos = size_t(first.size);
+			const auto last = pieces_.size() - 1;
+			for (auto i = 1U; i < last; ++i)
 			{
-				for (; c < candidate.size(); c++)
-				{
-					const auto f = candidate[c];
-					if (f != ' ' && f != '\t') return false;
-				}
-				return true;
+				const auto found = find(s, size, pos, piece(i), pieces_[i].size);
+				if (found == std::string::npos) return false;
+				pos = found + pieces_[i].size;
 			}
 
-			if (c_[p] == '?')
+			const auto last_size = size_t(pieces_[last].size);
+			if (last_size == 0) return true;
+
+			auto end = size;
+			while (end > 0 && (s[end - 1] == ' ' || s[end - 1] == '\t')) --end;
+			for (end = std::max(end, pos + last_size); end <= size; ++end)
 			{
-				for (; c < candidate.size(); c++)
-				{
-					if (match_pattern(candidate, p + 1U, c)) return true;
-				}
-				return match_pattern(candidate, p + 1U, c);
+				if (memcmp(s + end - last_size, piece(last), last_size) == 0) return true;
 			}
-			return c_[p] == candidate[c] && match_pattern(candidate, p + 1U, c + 1U);
+			return false;
 		}
 	};
 
 	using section_named = std::pair<std::string, creating_section>;
 	using sections_list = std::vector<section_named>;
-	using sections_map = robin_hood::unordered_flat_map<std::string, resulting_section>;
 
-	struct ini_parser_lua_params
+	// Sections by name and by reversed name, catches up with appended ones; reset it when erasing
+	struct sections_index
 	{
-		ini_parser_error_handler* error_handler{};
-		ini_parser_data_provider* data_provider{};
-		sections_list* sections{};
-
-		lua_State* lua_ptr{};
-		std::vector<std::string> imported;
+		// Fills positions of sections with matching names, in list order
+		void find(const sections_list& sections, const match_string& name, std::vector<uint32_t>& ret)
+		{
+			ret.clear();
+			update(sections);
 
-		ini_parser_lua_params(const ini_parser_lua_params&) = delete;
-		ini_parser_lua_params& operator=(const ini_parser_lua_params&) = delete;
+			std::string literal;
+			switch (name.literal(literal))
+			{
+				case match_string::anchor::exact:
+				{
+					if (const auto f = names_.find(literal); f != names_.end()) ret = f->second;
+					return;
+				}
+				case match_string::anchor::prefix: collect(names_, literal, ret);
+					break;
+				case match_string::anchor::suffix:
+				{
+					std::ranges::reverse(literal);
+					collect(reversed_, literal, ret);
+					break;
+				}
+				case match_string::anchor::none:
+				{
+					for (auto i = 0U, n = uint32_t(sections.size()); i < n; ++i)
+					{
+						if (name.test(sections[i].first)) ret.push_back(i);
+					}
+					return;
+				}
+			}
 
-		ini_parser_lua_params(sections_list* sections) : sections(sections) { }
-		~ini_parser_lua_params() { if (lua_ptr) lua_close(lua_ptr); }
+			std::erase_if(ret, [&](uint32_t i) { return !name.test(sections[i].first); });
+			std::ranges::sort(ret);
+		}
 
-		template <typename Callback>
-		void register_fn(const char* name, Callback callback)
+		void reset()
 		{
-			lua_pushlightuserdata(lua_ptr, this);
-			lua_pushcclosure(lua_ptr, callback, 1);
-			lua_setglobal(lua_ptr, name);
+			names_.clear();
+			reversed_.clear();
+			indexed_ = 0;
 		}
 
-		static ini_parser_lua_params* get_that(lua_State* L)
+	private:
+		using positions_map = std::map<std::string, std::vector<uint32_t>>;
+		positions_map names_;
+		positions_map reversed_;
+		size_t indexed_{};
+
+		void update(const sections_list& sections)
 		{
-			auto ret = (ini_parser_lua_params*)lua_touserdata(L, lua_upvalueindex(1));
-			return ret;
+			if (sections.size() < indexed_) reset();
+			for (; indexed_ < sections.size(); ++indexed_)
+			{
+				const auto& name = sections[indexed_].first;
+				names_[name].push_back(uint32_t(indexed_));
+				reversed_[std::string(name.rbegin(), name.rend())].push_back(uint32_t(indexed_));
+			}
 		}
 
-		static int read_fn(lua_State* L)
+		static void collect(const positions_map& map, const std::string& prefix, std::vector<uint32_t>& ret)
 		{
-			const auto that = get_that(L);
+			for (auto i = map.lower_bound(prefix); i != map.end() && i->first.compare(0, prefix.size(), prefix) == 0; ++i)
+			{
+				ret.insert(ret.end(), i->second.begin(), i->second.end());
+			}
+		}
+	};
+	using sections_map = robin_hood::unordered_flat_map<std::string, resulting_section>;
 
-			/* get number of arguments */
-			const auto n = lua_gettop(L);
-			if (n < 1 || n > 2)
+	// Compiled expressions kept in Lua registry, least recently used ones are dropped
+	struct lua_chunk_cache
+	{
+		static constexpr size_t capacity = 4096;
+
+		// Returns 0 with expression on stack or Lua error code, arguments are __arg1…__argN
+		int load(lua_State* L, const std::string& expr, int arguments, ini_parser_stats* stats)
+		{
+			std::string prologue;
+			if (arguments > 0)
 			{
-				lua_pushstring(L, "load: needs path and default value");
-				lua_error(L);
-				return 0;
+				prologue = "local ";
+				for (auto i = 1; i <= arguments; i++)
+				{
+					if (i > 1) prologue += ',';
+					prologue += "__arg" + std::to_string(i);
+				}
+				prologue += " = ... ";
 			}
 
-			if (!that->data_provider)
+			const auto& key = arguments > 0 ? prologue + expr : expr;
+			if (const auto f = entries.find(key); f != entries.end())
 			{
-				lua_pushstring(L, "load: data provider is not set");
-				lua_error(L);
+				order.splice(order.begin(), order, f->second.position);
+				if (stats) stats->lua_chunk_hits++;
+				if (f->second.ref == LUA_NOREF) return LUA_ERRSYNTAX;
+				if (f->second.statement) statements_loaded = true;
+				lua_rawgeti(L, LUA_REGISTRYINDEX, f->second.ref);
 				return 0;
 			}
 
-			try
+			if (stats) stats->lua_chunk_misses++;
+			auto ret = luaL_loadstring(L, (prologue + "return __conv_result(" + expr + ")").c_str());
+			auto statement = false;
+			if (ret == LUA_ERRSYNTAX)
+			{
+				lua_pop(L, 1);
+				ret = luaL_loadstring(L, (prologue + "return __conv_result((function() " + expr + " end)())").c_str());
+				statement = ret == 0;
+				statements_loaded = statements_loaded || statement;
+			}
+
+			if (ret == 0)
+			{
+				lua_pushvalue(L, -1);
+				add(L, key, luaL_ref(L, LUA_REGISTRYINDEX), statement);
+			}
+			else if (ret == LUA_ERRSYNTAX)
+			{
+				add(L, key, LUA_NOREF, false);
+			}
+			return ret;
+		}
+
+		// Statements might change global state, reset once pool restores globals
+		bool statements_loaded{};
+
+	private:
+		struct entry
+		{
+			int ref;
+			bool statement;
+			std::list<const std::string*>::iterator position;
+		};
+
+		robin_hood::unordered_node_map<std::string, entry> entries;
+		std::list<const std::string*> order;
+
+		void add(lua_State* L, const std::string& expr, int ref, bool statement)
+		{
+			if (entries.size() >= capacity)
+			{
+				const auto last = entries.find(*order.back());
+				if (last->second.ref != LUA_NOREF) luaL_unref(L, LUA_REGISTRYINDEX, last->second.ref);
+				order.pop_back();
+				entries.erase(last);
+			}
+
+			const auto added = entries.emplace(expr, entry{ref, statement, {}}).first;
+			order.push_front(&added->first);
+			added->second.position = order.begin();
+		}
+	};
+
+	// Passed to compiled expression as an argument instead of being pasted into code
+	struct lua_argument
+	{
+		enum class kind
+		{
+			number,
+			string,
+			table
+		};
+
+		// Lua only allows 200 locals per function, and arguments become locals
+		static constexpr int max_bound = 64;
+
+		kind type;
+		std::vector<std::string> values;
+	};
+
+	// Calls generator gathers to run for all iterations at once, replaced with [[SPEC:BATCH:index]] marks
+	struct lua_batch_collector
+	{
+		struct call
+		{
+			std::string code;
+			std::vector<lua_argument> arguments;
+			std::string prefix;
+			std::string postfix;
+		};
+
+		std::vector<call> calls;
+		bool failed{};
+	};
+
+	static int lua_dump_writer(lua_State* L, const void* p, size_t sz, void* ud)
+	{
+		static_cast<std::string*>(ud)->append(static_cast<const char*>(p), sz);
+		return 0;
+	}
+
+	// Order: set_std_lib() library, build-time bytecode, source; first one loaded is dumped for next states
+	static int lua_load_std_lib(lua_State* L)
+	{
+		std::unique_lock lock(std_lib_mutex);
+		if (!std_lib_bytecode.empty())
+		{
+			return luaL_loadbufferx(L, std_lib_bytecode.data(), std_lib_bytecode.size(), "std", "b");
+		}
+
+		auto ret = LUA_ERRFILE;
+		if (std_lib_data)
+		{
+			ret = luaL_loadbuffer(L, std_lib_data->data(), std_lib_data->size(), "std");
+		}
+		#ifdef USE_SIMPLE
+		else
+		{
+			// Bytecode only loads if it was dumped by the same Lua build, otherwise source is compiled instead
+			if (LUA_STD_BYTECODE_SIZE > 0)
+			{
+				ret = luaL_loadbufferx(L, (const char*)LUA_STD_BYTECODE, LUA_STD_BYTECODE_SIZE, "std", "b");
+				if (ret != 0) lua_pop(L, 1);
+			}
+			if (ret != 0) ret = luaL_loadstring(L, LUA_STD_LUB);
+		}
+		#endif
+
+		if (ret == 0)
+		{
+			#ifdef USE_SIMPLE
+			const auto dumped = lua_dump(L, lua_dump_writer, &std_lib_bytecode, 0);
+			#else
+			const auto dumped = lua_dump(L, lua_dump_writer, &std_lib_bytecode);
+			#endif
+			if (dumped != 0) std_lib_bytecode.clear();
+		}
+		return ret;
+	}
+
+	#ifdef USE_SIMPLE
+	// Refuses to go over memory limit, so Lua raises out of memory error instead of crashing
+	struct lua_allocator
+	{
+		size_t used{};
+		size_t peak{};
+		size_t limit{};
+
+		static void* alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+		{
+			const auto that = static_cast<lua_allocator*>(ud);
+			if (!ptr) osize = 0;
+			if (nsize == 0)
+			{
+				std::free(ptr);
+				that->used -= osize;
+				return nullptr;
+			}
+			if (that->limit && nsize > osize && that->used + (nsize - osize) > that->limit) return nullptr;
+
+			// Lua expects shrinking to never fail
+			const auto ret = std::realloc(ptr, nsize);
+			if (!ret) return nsize <= osize ? ptr : nullptr;
+			that->used = that->used - osize + nsize;
+			that->peak = std::max(that->peak, that->used);
+			return ret;
+		}
+
+		static lua_allocator* get(lua_State* L)
+		{
+			void* ud;
+			return lua_getallocf(L, &ud) == alloc ? static_cast<lua_allocator*>(ud) : nullptr;
+		}
+	};
+
+	static int lua_panic_fn(lua_State* L)
+	{
+		const auto error_msg = lua_tostring(L, -1);
+		LOG(ERROR) << "Lua panic: " << (error_msg ? error_msg : "unknown error");
+		return 0;
+	}
+	#endif
+
+	static lua_State* lua_new_state()
+	{
+		#ifdef USE_SIMPLE
+		const auto allocator = new lua_allocator();
+		const auto L = lua_newstate(lua_allocator::alloc, allocator);
+		if (!L)
+		{
+			delete allocator;
+			return nullptr;
+		}
+		lua_atpanic(L, lua_panic_fn);
+		return L;
+		#else
+		return luaL_newstate();
+		#endif
+	}
+
+	static void lua_close_state(lua_State* L)
+	{
+		#ifdef USE_SIMPLE
+		const auto allocator = lua_allocator::get(L);
+		lua_close(L);
+		delete allocator;
+		#else
+		lua_close(L);
+		#endif
+	}
+
+	// Globals and tables stored in them directly, to restore state before another parser uses it
+	static constexpr auto LUA_SNAPSHOT_KEY = "inipp.snapshot";
+
+	static void lua_push_globals(lua_State* L)
+	{
+		#ifdef USE_SIMPLE
+		lua_pushglobaltable(L);
+		#else
+		lua_pushvalue(L, LUA_GLOBALSINDEX);
+		#endif
+	}
+
+	static void lua_push_copy(lua_State* L, int index)
+	{
+		if (index < 0) index = lua_gettop(L) + index + 1;
+		lua_newtable(L);
+		lua_pushnil(L);
+		while (lua_next(L, index))
+		{
+			lua_pushvalue(L, -2);
+			lua_insert(L, -2);
+			lua_rawset(L, -4);
+		}
+	}
+
+	static int lua_snapshot_fn(lua_State* L)
+	{
+		lua_settop(L, 0);
+		lua_newtable(L);
+		lua_push_globals(L);
+		lua_pushvalue(L, 2);
+		lua_push_copy(L, 2);
+		lua_rawset(L, 1);
+		lua_pushnil(L);
+		while (lua_next(L, 2))
+		{
+			if (lua_istable(L, -1))
+			{
+				lua_pushvalue(L, -1);
+				lua_push_copy(L, -1);
+				lua_rawset(L, 1);
+			}
+			lua_pop(L, 1);
+		}
+		lua_pushvalue(L, 1);
+		lua_setfield(L, LUA_REGISTRYINDEX, LUA_SNAPSHOT_KEY);
+		return 0;
+	}
+
+	static int lua_restore_fn(lua_State* L)
+	{
+		lua_settop(L, 0);
+		lua_getfield(L, LUA_REGISTRYINDEX, LUA_SNAPSHOT_KEY);
+		if (!lua_istable(L, 1)) return luaL_error(L, "State has no snapshot");
+		lua_newtable(L);
+		lua_pushnil(L);
+		while (lua_next(L, 1))
+		{
+			// Stack: 1 => snapshot; 2 => keys to remove; 3 => table; 4 => its copy
+			auto removed = 0;
+			lua_pushnil(L);
+			while (lua_next(L, 3))
+			{
+				lua_pop(L, 1);
+				lua_pushvalue(L, -1);
+				lua_rawget(L, 4);
+				if (lua_isnil(L, -1))
+				{
+					lua_pushvalue(L, -2);
+					lua_rawseti(L, 2, ++removed);
+				}
+				lua_pop(L, 1);
+			}
+			for (auto i = 1; i <= removed; i++)
+			{
+				lua_rawgeti(L, 2, i);
+				lua_pushnil(L);
+				lua_rawset(L, 3);
+			}
+			lua_pushnil(L);
+			while (lua_next(L, 4))
+			{
+				lua_pushvalue(L, -2);
+				lua_insert(L, -2);
+				lua_rawset(L, 3);
+			}
+			lua_pop(L, 1);
+		}
+		return 0;
+	}
+
+	struct ini_parser_lua_pool_data
+	{
+		struct idle_state
+		{
+			lua_State* L;
+			lua_chunk_cache chunks;
+		};
+
+		std::mutex mutex;
+		std::vector<idle_state> idle;
+		size_t max_idle;
+		std::atomic<size_t> created{};
+		std::atomic<size_t> reused{};
+
+		explicit ini_parser_lua_pool_data(size_t max_idle) : max_idle(max_idle) {}
+		~ini_parser_lua_pool_data() { clear(); }
+
+		// Compiled expressions stay with their state: globals table remains the same, so they are still valid
+		bool acquire(lua_State*& L, lua_chunk_cache& chunks)
+		{
+			std::unique_lock lock(mutex);
+			if (idle.empty())
+			{
+				++created;
+				return false;
+			}
+			++reused;
+			L = idle.back().L;
+			chunks = std::move(idle.back().chunks);
+			idle.pop_back();
+			return true;
+		}
+
+		void release(lua_State* L, lua_chunk_cache&& chunks)
+		{
+			lua_settop(L, 0);
+			lua_pushcfunction(L, lua_restore_fn);
+			if (lua_pcall(L, 0, 0, 0) == 0)
+			{
+				std::unique_lock lock(mutex);
+				if (idle.size() < max_idle)
+				{
+					idle.push_back({L, std::move(chunks)});
+					return;
+				}
+			}
+			lua_close_state(L);
+		}
+
+		void clear()
+		{
+			std::unique_lock lock(mutex);
+			for (const auto& i : idle) lua_close_state(i.L);
+			idle.clear();
+		}
+	};
+
+	struct ini_parser_lua_params
+	{
+		ini_parser_error_handler* error_handler{};
+		ini_parser_data_provider* data_provider{};
+		ini_parser_stats* stats{};
+		int stats_phase = -1;
+		uint64_t stats_since{};
+		uint64_t lua_runs{};
+		sections_list* sections{};
+		sections_index index;
+		std::vector<uint32_t> found;
+
+		// Scripts tend to call reflection functions with the same patterns in loops
+		static constexpr size_t patterns_capacity = 1024;
+		robin_hood::unordered_node_map<std::string, match_string> patterns;
+
+		ini_parser_lua_pool* pool{};
+		lua_State* lua_ptr{};
+		lua_chunk_cache chunks;
+		std::vector<std::string> imported;
+
+		// Zero for no limit
+		static constexpr int budget_step = 1000;
+		uint64_t instructions_limit{};
+		uint64_t instructions_used{};
+		size_t memory_limit{};
+
+		// Used until custom code, statements or state-changing expressions run
+		robin_hood::unordered_node_map<std::string, std::unique_ptr<ini_parser_expression>> native_expressions;
+		bool custom_lua{};
+
+		// Arguments expressions being substituted refer to with [[SPEC:ARG:index]]
+		std::vector<lua_argument> expression_args;
+
+		// Set while generator gathers expressions to run them in a batch
+		lua_batch_collector* collector{};
+
+		ini_parser_lua_params(const ini_parser_lua_params&) = delete;
+		ini_parser_lua_params& operator=(const ini_parser_lua_params&) = delete;
+
+		ini_parser_lua_params(sections_list* sections) : sections(sections) { }
+		~ini_parser_lua_params()
+		{
+			if (!lua_ptr) return;
+			apply_limits(false);
+
+			// Restoring only covers globals and tables they refer to, custom code could change anything else
+			if (pool && !custom_lua && !chunks.statements_loaded) pool->data_->release(lua_ptr, std::move(chunks));
+			else lua_close_state(lua_ptr);
+		}
+
+		// Limits only apply to code from parsed files, not to initializing or restoring state
+		void apply_limits(bool enabled)
+		{
+			#ifdef USE_SIMPLE
+			if (const auto allocator = lua_allocator::get(lua_ptr))
+			{
+				allocator->limit = enabled ? memory_limit : 0;
+				allocator->peak = allocator->used;
+			}
+			#endif
+			if (enabled && instructions_limit)
+			{
+				lua_pushlightuserdata(lua_ptr, this);
+				lua_setfield(lua_ptr, LUA_REGISTRYINDEX, LUA_PARAMS_KEY);
+				lua_sethook(lua_ptr, budget_hook, LUA_MASKCOUNT, budget_step);
+			}
+			else
+			{
+				lua_sethook(lua_ptr, nullptr, 0, 0);
+			}
+		}
+
+		size_t memory_peak() const
+		{
+			#ifdef USE_SIMPLE
+			if (const auto allocator = lua_allocator::get(lua_ptr)) return allocator->peak;
+			#endif
+			return size_t(lua_gc(lua_ptr, LUA_GCCOUNT, 0)) * 1024U + size_t(lua_gc(lua_ptr, LUA_GCCOUNTB, 0));
+		}
+
+		static constexpr auto LUA_PARAMS_KEY = "inipp.params";
+
+		static void budget_hook(lua_State* L, lua_Debug* ar)
+		{
+			lua_getfield(L, LUA_REGISTRYINDEX, LUA_PARAMS_KEY);
+			const auto that = (ini_parser_lua_params*)lua_touserdata(L, -1);
+			lua_pop(L, 1);
+			if (!that) return;
+			that->instructions_used += budget_step;
+			if (that->instructions_used <= that->instructions_limit) return;
+			if (that->stats) that->stats->lua_limit_errors++;
+			lua_pushstring(L, ("Lua instructions limit of " + std::to_string(that->instructions_limit) + " is exceeded").c_str());
+			lua_error(L);
+		}
+
+		template <typename Callback>
+		void register_fn(const char* name, Callback callback)
+		{
+			lua_pushlightuserdata(lua_ptr, this);
+			lua_pushcclosure(lua_ptr, callback, 1);
+			lua_setglobal(lua_ptr, name);
+		}
+
+		static ini_parser_lua_params* get_that(lua_State* L)
+		{
+			auto ret = (ini_parser_lua_params*)lua_touserdata(L, lua_upvalueindex(1));
+			return ret;
+		}
+
+		// References stay valid until next call of reflection function: cache is only trimmed in prepare_patterns()
+		const match_string& get_pattern(lua_State* L, int index)
+		{
+			static const match_string any{nullptr};
+			const auto s = lua_tostring(L, index);
+			if (!s) return any;
+			auto f = patterns.find(s);
+			if (f == patterns.end()) f = patterns.emplace(s, match_string(s)).first;
+			return f->second;
+		}
+
+		void prepare_patterns()
+		{
+			if (patterns.size() >= patterns_capacity) patterns.clear();
+		}
+
+		static int read_fn(lua_State* L)
+		{
+			const auto that = get_that(L);
+
+			/* get number of arguments */
+			const auto n = lua_gettop(L);
+			if (n < 1 || n > 2)
+			{
+				lua_pushstring(L, "load: needs path and default value");
+				lua_error(L);
+				return 0;
+			}
+
+			if (!that->data_provider)
+			{
+				lua_pushstring(L, "load: data provider is not set");
+				lua_error(L);
+				return 0;
+			}
+
+			try
 			{
 				const auto p = lua_tostring(L, 1);
 				if (p == nullptr)
@@ -714,21 +1601,23 @@ namespace utils
 			}
 
 			const auto that = get_that(L);
-			const match_string section = lua_tostring(L, 1);
-			const match_string key = n > 1 ? lua_tostring(L, 2) : nullptr;
-			const match_string value = n > 2 ? lua_tostring(L, 3) : nullptr;
+			that->prepare_patterns();
+			const auto& section = that->get_pattern(L, 1);
+			const auto& key = that->get_pattern(L, 2);
+			const auto& value = that->get_pattern(L, 3);
 
 			if (const auto sections = that->sections)
 			{
-				for (const auto& p : *sections)
+				that->index.find(*sections, section, that->found);
+				for (const auto i : that->found)
 				{
-					if (!section.test(p.first)) continue;
+					const auto& p = (*sections)[i];
 					if (key.empty() && value.empty())
 					{
 						lua_pushboolean(L, true);
 						return 1;
 					}
-					for (const auto& k : p.second.values)
+					for (const auto& k : p.second)
 					{
 						if (key.test(k.first) && value.test(k.second))
 						{
@@ -753,8 +1642,9 @@ namespace utils
 			}
 
 			const auto that = get_that(L);
-			const match_string section = lua_tostring(L, 1);
-			const match_string key = lua_tostring(L, 2);
+			that->prepare_patterns();
+			const auto& section = that->get_pattern(L, 1);
+			const auto& key = that->get_pattern(L, 2);
 
 			variant value;
 			auto ret_type = -1;
@@ -766,10 +1656,10 @@ namespace utils
 
 			if (const auto sections = that->sections)
 			{
-				for (const auto& p : *sections)
+				that->index.find(*sections, section, that->found);
+				for (const auto i : that->found)
 				{
-					if (!section.test(p.first)) continue;
-					for (const auto& k : p.second.values)
+					for (const auto& k : (*sections)[i].second)
 					{
 						if (key.test(k.first))
 						{
@@ -793,8 +1683,9 @@ namespace utils
 			}
 
 			const auto that = get_that(L);
-			const match_string section = lua_tostring(L, 1);
-			const match_string key = lua_tostring(L, 2);
+			that->prepare_patterns();
+			const auto& section = that->get_pattern(L, 1);
+			const auto& key = that->get_pattern(L, 2);
 
 			variant value;
 			lua_parse(L, 3, value, "", "");
@@ -802,23 +1693,19 @@ namespace utils
 			auto set = 0U;
 			if (const auto sections = that->sections)
 			{
-				// for (auto& p : *sections)
-				for (auto i = sections->begin(); i != sections->end();)
+				// Going backwards, so erasing a section doesn’t move ones yet to be processed
+				that->index.find(*sections, section, that->found);
+				for (auto f = that->found.rbegin(); f != that->found.rend(); ++f)
 				{
-					if (!section.test(i->first))
-					{
-						++i;
-						continue;
-					}
-
+					const auto i = sections->begin() + ptrdiff_t(*f);
 					auto any_set = false;
-					for (auto j = i->second.values.begin(); j != i->second.values.end();)
+					for (auto j = i->second.begin(); j != i->second.end();)
 					{
 						if (key.test(j->first))
 						{
 							if (value.empty())
 							{
-								j = i->second.values.erase(j);
+								j = i->second.erase(j);
 							}
 							else
 							{
@@ -834,18 +1721,15 @@ namespace utils
 						}
 					}
 
-					if (any_set && value.empty() && i->second.values.empty())
+					if (any_set && value.empty() && i->second.empty())
 					{
-						i = sections->erase(i);
+						sections->erase(i);
+						that->index.reset();
 					}
-					else
+					else if (!any_set && !key.fuzzy() && !value.empty())
 					{
-						if (!any_set && !key.fuzzy() && !value.empty())
-						{
-							i->second.set(key.c_str(), value);
-							++set;
-						}
-						++i;
+						i->second.set(key.c_str(), value);
+						++set;
 					}
 				}
 
@@ -864,14 +1748,22 @@ namespace utils
 
 		lua_State* lua_get_state()
 		{
-			if (!lua_ptr)
+			if (lua_ptr) return lua_ptr;
+			if (pool && pool->data_->acquire(lua_ptr, chunks))
+			{
+				register_fn("read", read_fn);
+				register_fn("has", refl_has_fn);
+				register_fn("get", refl_get_fn);
+				register_fn("set", refl_set_fn);
+			}
+			else
 			{
-				lua_ptr = luaL_newstate();
+				lua_ptr = lua_new_state();
 				#ifdef USE_SIMPLE
 				luaL_requiref(lua_ptr, "_G", luaopen_base, 1);
 				luaL_requiref(lua_ptr, "math", luaopen_math, 1);
 				luaL_requiref(lua_ptr, "string", luaopen_string, 1);
-				if (luaL_loadstring(lua_ptr, LUA_STD_LUB))
+				if (lua_load_std_lib(lua_ptr))
 				{
 					const char* error_msg = lua_tostring(lua_ptr, -1);
 					LOG(ERROR) << "Lua syntax error: " << error_msg;
@@ -887,24 +1779,130 @@ namespace utils
 				luaopen_base(lua_ptr);
 				luaopen_math(lua_ptr);
 				luaopen_string(lua_ptr);
-				if (std_lib_data)
+				if (const auto ret = lua_load_std_lib(lua_ptr); ret == LUA_ERRFILE)
 				{
-					luaL_loadbuffer(lua_ptr, std_lib_data->data(), std_lib_data->size(), "std") || lua_pcall(lua_ptr, 0, -1, 0);
+					LOG(WARNING) << "Standard INIpp Lua library is missing";
 				}
-				else
+				else if (ret == 0)
 				{
-					LOG(WARNING) << "Standard INIpp Lua library is missing";
+					lua_pcall(lua_ptr, 0, -1, 0);
 				}
 				#endif
+				if (pool)
+				{
+					lua_pushcfunction(lua_ptr, lua_snapshot_fn);
+					lua_pcall(lua_ptr, 0, 0, 0);
+					lua_settop(lua_ptr, 0);
+				}
 				register_fn("read", read_fn);
 				register_fn("has", refl_has_fn);
 				register_fn("get", refl_get_fn);
 				register_fn("set", refl_set_fn);
 			}
+			apply_limits(true);
 			return lua_ptr;
 		}
 	};
 
+	const char* ini_parser_stats::phase_name(int phase)
+	{
+		switch (phase)
+		{
+			case lexing: return "lexing";
+			case substitution: return "substitution";
+			case lua: return "lua";
+			case templates: return "templates";
+			case generators: return "generators";
+			case includes: return "includes";
+			case sequential: return "sequential";
+			default: return "unknown";
+		}
+	}
+
+	static uint64_t thread_cpu_ns()
+	{
+		#ifdef _WIN32
+		FILETIME creation, exit, kernel, user;
+		if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) return 0;
+		const auto ticks = [](const FILETIME& t) { return uint64_t(t.dwHighDateTime) << 32 | t.dwLowDateTime; };
+		return (ticks(kernel) + ticks(user)) * 100U;
+		#else
+		timespec t{};
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+		return uint64_t(t.tv_sec) * 1000000000U + uint64_t(t.tv_nsec);
+		#endif
+	}
+
+	// Counts CPU time Lua code takes and memory it needs
+	struct lua_usage_scope
+	{
+		ini_parser_lua_params& params;
+		uint64_t start;
+
+		explicit lua_usage_scope(ini_parser_lua_params& params)
+			: params(params), start(params.stats ? thread_cpu_ns() : 0) { }
+
+		lua_usage_scope(const lua_usage_scope& other) = delete;
+		lua_usage_scope& operator=(const lua_usage_scope& other) = delete;
+
+		~lua_usage_scope()
+		{
+			if (!params.stats || !params.lua_ptr) return;
+			params.stats->lua_cpu_ns += thread_cpu_ns() - start;
+			params.stats->lua_memory_peak = std::max(params.stats->lua_memory_peak, uint64_t(params.memory_peak()));
+		}
+	};
+
+	// Pauses phase which was active before and resumes it once done, so nested phases are not counted twice
+	struct stats_scope
+	{
+		ini_parser_lua_params* params;
+		int previous_phase;
+
+		stats_scope(ini_parser_lua_params& lua_params, ini_parser_stats::phase phase, size_t bytes = 0)
+			: stats_scope(&lua_params, phase, bytes) {}
+
+		stats_scope(ini_parser_lua_params* lua_params, ini_parser_stats::phase phase, size_t bytes = 0)
+			: params(lua_params && lua_params->stats ? lua_params : nullptr), previous_phase(-1)
+		{
+			if (!params) return;
+			const auto now = now_ns();
+			if (params->stats_phase != -1)
+			{
+				params->stats->phases[params->stats_phase].nanoseconds += now - params->stats_since;
+			}
+			previous_phase = params->stats_phase;
+			params->stats_phase = phase;
+			params->stats_since = now;
+			auto& counter = params->stats->phases[phase];
+			counter.calls++;
+			counter.bytes += bytes;
+		}
+
+		stats_scope(const stats_scope& other) = delete;
+		stats_scope& operator=(const stats_scope& other) = delete;
+
+		~stats_scope()
+		{
+			if (!params) return;
+			const auto now = now_ns();
+			params->stats->phases[params->stats_phase].nanoseconds += now - params->stats_since;
+			params->stats_phase = previous_phase;
+			params->stats_since = now;
+		}
+
+		void add_bytes(size_t bytes) const
+		{
+			if (params) params->stats->phases[params->stats_phase].bytes += bytes;
+		}
+
+	private:
+		static uint64_t now_ns()
+		{
+			return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+		}
+	};
+
 	struct script_params
 	{
 		path file;
@@ -920,62 +1918,381 @@ namespace utils
 		script_params& operator=(const script_params& other) = delete;
 	};
 
+	static bool is_number_literal(const std::string& s);
+	static std::string lua_argument_literal(const lua_argument& arg);
+
+	// Replaces [[SPEC:ARG:index]] marks with argument names, or with values if arguments aren’t used
+	static std::string lua_bind_arguments(const std::string& expr, const ini_parser_lua_params& lua_params, std::vector<size_t>* bound)
+	{
+		std::string ret;
+		size_t last = 0;
+		for (auto i = expr.find(SPECIAL_ARGUMENT); i != std::string::npos; i = expr.find(SPECIAL_ARGUMENT, last))
+		{
+			const auto end = expr.find(SPECIAL_ARGUMENT_END, i + SPECIAL_ARGUMENT.size());
+			if (end == std::string::npos) break;
+			const auto index = size_t(std::strtoull(expr.c_str() + i + SPECIAL_ARGUMENT.size(), nullptr, 10));
+			if (index >= lua_params.expression_args.size()) break;
+			ret.append(expr, last, i - last);
+			if (bound && bound->size() < size_t(lua_argument::max_bound))
+			{
+				bound->push_back(index);
+				ret += "__arg" + std::to_string(bound->size());
+			}
+			else
+			{
+				ret += lua_argument_literal(lua_params.expression_args[index]);
+			}
+			last = end + SPECIAL_ARGUMENT_END.size();
+		}
+		if (last == 0) return expr;
+		ret.append(expr, last);
+		return ret;
+	}
+
+	// Numbers are pushed the way Lua would read them from code, integers stay integers
+	static void lua_push_number(lua_State* L, const std::string& value)
+	{
+		#ifdef USE_SIMPLE
+		if (!lua_stringtonumber(L, value.c_str())) lua_pushlstring(L, value.data(), value.size());
+		#else
+		lua_pushnumber(L, std::strtod(value.c_str(), nullptr));
+		#endif
+	}
+
+	static void lua_push_argument(lua_State* L, const lua_argument& arg)
+	{
+		switch (arg.type)
+		{
+			case lua_argument::kind::number: lua_push_number(L, arg.values[0]);
+				break;
+			case lua_argument::kind::string: lua_pushlstring(L, arg.values[0].data(), arg.values[0].size());
+				break;
+			case lua_argument::kind::table:
+			{
+				lua_createtable(L, int(arg.values.size()), 0);
+				for (auto i = 0, n = int(arg.values.size()); i < n; i++)
+				{
+					const auto& v = arg.values[i];
+					if (is_number_literal(v)) lua_push_number(L, v);
+					else lua_pushlstring(L, v.data(), v.size());
+					lua_rawseti(L, -2, i + 1);
+				}
+				break;
+			}
+		}
+	}
+
+	// Returns false if expression has to go to Lua, doesn’t prevent include caching
+	static bool lua_calculate_native(variant& dest, const std::string& code, const std::vector<size_t>& bound,
+		const std::string& prefix, const std::string& postfix, ini_parser_lua_params& lua_params)
+	{
+		#ifdef USE_SIMPLE
+		if (lua_params.custom_lua || lua_params.chunks.statements_loaded || std_lib_replaced) return false;
+
+		std::vector<const std::string*> arguments;
+		arguments.reserve(bound.size());
+		for (const auto index : bound)
+		{
+			const auto& arg = lua_params.expression_args[index];
+			if (arg.type != lua_argument::kind::number) return false;
+			arguments.push_back(&arg.values[0]);
+		}
+
+		auto& cache = lua_params.native_expressions;
+		auto found = cache.find(code);
+		if (found == cache.end())
+		{
+			if (cache.size() >= lua_chunk_cache::capacity) cache.clear();
+			found = cache.emplace(code, ini_parser_expression::compile(code)).first;
+		}
+		if (!found->second) return false;
+
+		std::vector<std::string> results;
+		if (!found->second->evaluate(arguments, results)) return false;
+		for (const auto& r : results)
+		{
+			dest.push_back(prefix + r + postfix);
+		}
+		if (lua_params.stats) lua_params.stats->lua_native++;
+		return true;
+		#else
+		return false;
+		#endif
+	}
+
+	static bool lua_uses_any(const std::string& code, std::initializer_list<const char*> names)
+	{
+		for (size_t i = 0, n = code.size(); i < n;)
+		{
+			const auto c = code[i];
+			if (!isalpha(uint8_t(c)) && c != '_')
+			{
+				i++;
+				continue;
+			}
+			const auto start = i;
+			while (i < n && (isalnum(uint8_t(code[i])) || code[i] == '_')) i++;
+			for (const auto name : names)
+			{
+				if (code.compare(start, i - start, name) == 0) return true;
+			}
+		}
+		return false;
+	}
+
+	// Identifiers through which an expression could change Lua state outside of what pooled states restore
+	#define LUA_STATE_CHANGING "random", "randomseed", "load", "loadstring", "dofile", "require", "rawset", \
+		"setmetatable", "getmetatable", "debug", "collectgarbage", "_G", "_ENV"
+
+	static bool lua_changes_state(const std::string& code)
+	{
+		return lua_uses_any(code, {LUA_STATE_CHANGING});
+	}
+
+	// Batched expressions run out of order, so they can only depend on their arguments
+	static bool lua_batch_allowed(const std::string& code)
+	{
+		return !lua_uses_any(code, {"has", "get", "set", "read", "print", "discard", LUA_STATE_CHANGING});
+	}
+
+	static void lua_collect(lua_batch_collector& collector, variant& dest, const std::string& code, const std::vector<size_t>& bound,
+		const std::string& prefix, const std::string& postfix, const ini_parser_lua_params& lua_params)
+	{
+		if (!lua_batch_allowed(code))
+		{
+			collector.failed = true;
+			return;
+		}
+
+		lua_batch_collector::call call;
+		call.code = code;
+		call.arguments.reserve(bound.size());
+		for (const auto index : bound)
+		{
+			call.arguments.push_back(lua_params.expression_args[index]);
+		}
+		call.prefix = prefix;
+		call.postfix = postfix;
+		collector.calls.push_back(std::move(call));
+		dest.push_back(wrap_special(SPECIAL_BATCH, std::to_string(collector.calls.size() - 1)));
+	}
+
 	static void lua_calculate(const str_view& key, bool& include_value, variant& dest, const std::string& expr,
 		const std::string& prefix, const std::string& postfix,
 		const path& file, ini_parser_lua_params& lua_params)
 	{
+		stats_scope stats(lua_params, ini_parser_stats::lua, expr.size());
+		std::vector<size_t> bound;
+		const auto code = lua_bind_arguments(expr, lua_params, &bound);
+		if (lua_calculate_native(dest, code, bound, prefix, postfix, lua_params)) return;
+		if (lua_params.collector)
+		{
+			lua_collect(*lua_params.collector, dest, code, bound, prefix, postfix, lua_params);
+			return;
+		}
+
+		lua_params.lua_runs++;
+		if (lua_changes_state(code)) lua_params.custom_lua = true;
 		const auto L = lua_params.lua_get_state();
+		lua_usage_scope usage(lua_params);
+		const auto command = [&] { return lua_bind_arguments(expr, lua_params, nullptr); };
+		const auto out_of_memory = [&](const char* stage)
+		{
+			include_value = false;
+			auto message = std::string("Out of memory trying to ") + stage;
+			if (lua_params.memory_limit)
+			{
+				message += ", Lua memory is limited to " + std::to_string(lua_params.memory_limit) + " bytes";
+				if (lua_params.stats) lua_params.stats->lua_limit_errors++;
+			}
+			if (lua_params.error_handler) lua_params.error_handler->on_error(file, (message + "\nKey: " + key.str() + "\nCommand: " + command()).c_str());
+			else LOG(ERROR) << "Failed to process `" << command() << "`: " << message;
+		};
 
-		auto ret = luaL_loadstring(L, ("return __conv_result(" + expr + ")").c_str());
+		auto ret = lua_params.chunks.load(L, code, int(bound.size()), lua_params.stats);
 		if (ret == LUA_ERRSYNTAX)
 		{
-			ret = luaL_loadstring(L, ("return __conv_result((function() " + expr + " end)())").c_str());
+			LOG(ERROR) << "Failed to process `" << command() << "`: syntax error";
+			include_value = false;
+			return;
 		}
 
-		if (ret == LUA_ERRSYNTAX)
+		if (ret == LUA_ERRMEM)
+		{
+			out_of_memory("load expression");
+			return;
+		}
+
+		for (const auto index : bound)
+		{
+			lua_push_argument(L, lua_params.expression_args[index]);
+		}
+
+		ret = lua_pcall(L, int(bound.size()), -1, 0);
+		if (ret == LUA_ERRMEM)
 		{
-			LOG(ERROR) << "Failed to process `" << expr << "`: syntax error";
+			lua_pop(L, 1);
+			out_of_memory("run expression");
+			return;
+		}
+
+		if (ret == LUA_ERRERR)
+		{
+			LOG(ERROR) << "Failed to process `" << command() << "`: error in error";
 			include_value = false;
 			return;
 		}
 
-		if (ret == LUA_ERRMEM)
-		{
-			LOG(ERROR) << "Failed to process `" << expr << "`: out of memory trying to load expression";
-			include_value = false;
-			return;
-		}
+		if (ret != 0)
+		{
+			const auto error_ptr = lua_tolstring(L, -1, nullptr);
+			const auto error_msg = error_ptr ? std::string(error_ptr) : "";
+			if (error_msg.find("__discardError__") != std::string::npos)
+			{
+				include_value = false;
+				return;
+			}
+			if (lua_params.error_handler) lua_params.error_handler->on_error(file, (error_msg + "\nKey: " + key.str() + "\nCommand: " + command()).c_str());
+			if (!prefix.empty() || !postfix.empty()) dest.push_back(prefix + postfix);
+			return;
+		}
+
+		lua_parse(L, -1, dest, prefix, postfix);
+	}
+
+	// Loop calling expression for each set of arguments, compiled once per argument count
+	static bool lua_push_batch_runner(lua_State* L, int arguments)
+	{
+		const auto key = "inipp.batch." + std::to_string(arguments);
+		lua_getfield(L, LUA_REGISTRYINDEX, key.c_str());
+		if (lua_isfunction(L, -1)) return true;
+		lua_pop(L, 1);
+
+		std::string code = "local f, args, n = ...\nlocal ret, failed = {}, {}\nfor i = 1, n do\nlocal a = args[i]\nlocal ok, v = pcall(f";
+		for (auto i = 1; i <= arguments; i++)
+		{
+			code += ", a[" + std::to_string(i) + "]";
+		}
+		code += ")\nif ok then ret[i] = v else failed[i] = true end\nend\nreturn ret, failed";
+		if (luaL_loadstring(L, code.c_str()) != 0)
+		{
+			lua_pop(L, 1);
+			return false;
+		}
+		lua_pushvalue(L, -1);
+		lua_setfield(L, LUA_REGISTRYINDEX, key.c_str());
+		return true;
+	}
+
+	// One Lua call per distinct expression, failed calls are left empty to run again the usual way
+	static void lua_calculate_batch(const lua_batch_collector& collector, ini_parser_lua_params& lua_params,
+		std::vector<std::optional<variant>>& results)
+	{
+		results.assign(collector.calls.size(), std::nullopt);
+		if (collector.calls.empty()) return;
+
+		stats_scope stats(lua_params, ini_parser_stats::lua);
+		lua_params.lua_runs += collector.calls.size();
+		const auto L = lua_params.lua_get_state();
+		lua_usage_scope usage(lua_params);
+
+		std::vector<std::vector<size_t>> groups;
+		robin_hood::unordered_flat_map<std::string, size_t> group_indices;
+		for (size_t i = 0; i < collector.calls.size(); i++)
+		{
+			const auto& code = collector.calls[i].code;
+			auto found = group_indices.find(code);
+			if (found == group_indices.end())
+			{
+				found = group_indices.emplace(code, groups.size()).first;
+				groups.emplace_back();
+			}
+			groups[found->second].push_back(i);
+		}
+
+		for (const auto& group : groups)
+		{
+			const auto& first = collector.calls[group[0]];
+			const auto arguments = int(first.arguments.size());
+			const auto top = lua_gettop(L);
+			if (!lua_push_batch_runner(L, arguments))
+			{
+				lua_settop(L, top);
+				continue;
+			}
+
+			const auto statements_loaded = lua_params.chunks.statements_loaded;
+			if (lua_params.chunks.load(L, first.code, arguments, lua_params.stats) != 0
+				|| lua_params.chunks.statements_loaded != statements_loaded)
+			{
+				lua_settop(L, top);
+				continue;
+			}
+
+			lua_createtable(L, int(group.size()), 0);
+			for (auto i = 0, n = int(group.size()); i < n; i++)
+			{
+				const auto& call = collector.calls[group[i]];
+				lua_createtable(L, arguments, 0);
+				for (auto j = 0; j < arguments; j++)
+				{
+					lua_push_argument(L, call.arguments[j]);
+					lua_rawseti(L, -2, j + 1);
+				}
+				lua_rawseti(L, -2, i + 1);
+			}
+			lua_pushinteger(L, lua_Integer(group.size()));
+
+			if (lua_pcall(L, 3, 2, 0) != 0)
+			{
+				lua_settop(L, top);
+				continue;
+			}
 
-		ret = lua_pcall(L, 0, -1, 0);
-		if (ret == LUA_ERRMEM)
-		{
-			LOG(ERROR) << "Failed to process `" << expr << "`: out of memory trying to run expression";
-			include_value = false;
-			return;
-		}
+			for (auto i = 0, n = int(group.size()); i < n; i++)
+			{
+				lua_rawgeti(L, top + 2, i + 1);
+				const auto failed = lua_toboolean(L, -1);
+				lua_pop(L, 1);
+				if (failed) continue;
 
-		if (ret == LUA_ERRERR)
-		{
-			LOG(ERROR) << "Failed to process `" << expr << "`: error in error";
-			include_value = false;
-			return;
+				const auto& call = collector.calls[group[i]];
+				variant v;
+				lua_rawgeti(L, top + 1, i + 1);
+				lua_parse(L, -1, v, call.prefix, call.postfix);
+				lua_pop(L, 1);
+				results[group[i]] = std::move(v);
+			}
+			lua_settop(L, top);
 		}
+	}
 
-		if (ret != 0)
+	// Returns nothing if any call failed or its mark became part of a bigger string
+	static std::optional<variant> lua_batch_fill(const variant& collected, const std::vector<std::optional<variant>>& results)
+	{
+		variant ret;
+		for (size_t i = 0, n = collected.size(); i < n; i++)
 		{
-			const auto error_ptr = lua_tolstring(L, -1, nullptr);
-			const auto error_msg = error_ptr ? std::string(error_ptr) : "";
-			if (error_msg.find("__discardError__") != std::string::npos)
+			const auto piece = collected.at(i).str();
+			const auto mark = piece.find(SPECIAL_BATCH);
+			if (mark == std::string::npos)
 			{
-				include_value = false;
-				return;
+				ret.push_back(piece);
+				continue;
 			}
-			if (lua_params.error_handler) lua_params.error_handler->on_error(file, (error_msg + "\nKey: " + key.str() + "\nCommand: " + expr).c_str());
-			if (!prefix.empty() || !postfix.empty()) dest.push_back(prefix + postfix);
-			return;
-		}
 
-		lua_parse(L, -1, dest, prefix, postfix);
+			const auto index = size_t(std::strtoull(piece.c_str() + SPECIAL_BATCH.size(), nullptr, 10));
+			if (mark != 0 || index >= results.size() || !results[index]
+				|| piece != wrap_special(SPECIAL_BATCH, std::to_string(index)))
+			{
+				return std::nullopt;
+			}
+			for (size_t j = 0, m = results[index]->size(); j < m; j++)
+			{
+				ret.push_back(results[index]->at(j).str());
+			}
+		}
+		return ret;
 	}
 
 	static void lua_register_function(const std::string& name, const variant& args, const std::string& body,
@@ -988,7 +2305,11 @@ namespace utils
 			args_line += arg;
 		}
 		const auto expr = "function " + name + "(" + args_line + ")\n" + body + "\nend";
+		stats_scope stats(lua_params, ini_parser_stats::lua, expr.size());
+		lua_params.lua_runs++;
+		lua_params.custom_lua = true;
 		const auto L = lua_params.lua_get_state();
+		lua_usage_scope usage(lua_params);
 		if ((luaL_loadstring(L, expr.c_str()) || lua_pcall(L, 0, -1, 0)) && lua_params.error_handler)
 		{
 			lua_params.error_handler->on_error(file, lua_tolstring(L, -1, nullptr));
@@ -1114,6 +2435,8 @@ namespace utils
 
 	static void lua_import(const path& name, const path& file, ini_parser_lua_params& lua_params)
 	{
+		// Counted even if already imported: whether it was depends on what was parsed before
+		lua_params.lua_runs++;
 		auto key = name.filename().string();
 		std::ranges::transform(key, key.begin(), tolower);
 		for (const auto& i : lua_params.imported)
@@ -1122,7 +2445,10 @@ namespace utils
 		}
 
 		lua_params.imported.push_back(key);
+		stats_scope stats(lua_params, ini_parser_stats::lua);
+		lua_params.custom_lua = true;
 		const auto L = lua_params.lua_get_state();
+		lua_usage_scope usage(lua_params);
 		if (luaL_loadfile(L, name.string().c_str()))
 		{
 			lua_params.error_handler->on_error(name, lua_errorcleanup(lua_tostring(L, -1)).c_str());
@@ -1195,7 +2521,7 @@ namespace utils
 			const auto end = value.find(SPECIAL_END, spec + SPECIAL_CALCULATE.size());
 			if (end == std::string::npos)
 			{
-				dest.push_back(value);
+				dest.push_back(lua_bind_arguments(value, *params->lua_params, nullptr));
 				return;
 			}
 
@@ -1276,9 +2602,9 @@ namespace utils
 		variable_info(const str_view& name, const str_view& default_value, const int from, const int to, const special_mode mode, const bool is_required)
 			: name(name), default_value(default_value), substr_from(from), substr_to(to), with_fallback(false), is_required(is_required), mode(mode) {}
 
-		bool get_values(const std::shared_ptr<variable_scope>& include_vars, std::vector<std::string>& result, bool& include_value, const value_finalizer& dest)
+		bool get_values(const scope_ref& include_vars, std::vector<std::string>& result, bool& include_value, const value_finalizer& dest)
 		{
-			const auto v = include_vars->find(name.str() /* TODO */);
+			const auto v = include_vars.find(name.str() /* TODO */);
 			if (!v)
 			{
 				if (is_required)
@@ -1434,7 +2760,7 @@ namespace utils
 			return true;
 		}
 
-		void substitute(const std::shared_ptr<variable_scope>& include_vars, bool& include_value, const value_finalizer& dest)
+		void substitute(const scope_ref& include_vars, bool& include_value, const value_finalizer& dest)
 		{
 			std::vector<std::string> result;
 			if (get_values(include_vars, result, include_value, dest))
@@ -1548,6 +2874,30 @@ namespace utils
 			}
 		}
 
+		// Values with variables or special marks in them are pasted into expression, so those would be processed further
+		static bool is_passable(const std::string& s)
+		{
+			return s.find('$') == std::string::npos && s.find("[[SPEC:") == std::string::npos && s.find(SPECIAL_END_STR) == std::string::npos;
+		}
+
+		// Signed numbers are pasted instead: sign binds weaker than ^, so passing them would change results
+		std::optional<lua_argument::kind> argument_type(const std::string& s) const
+		{
+			const auto as_string = mode == special_mode::string || (mode == special_mode::none || mode >= special_mode::x && mode <= special_mode::w)
+				&& !is_number(str_view::from_str(s));
+			if (as_string) return is_passable(s) ? std::optional(lua_argument::kind::string) : std::nullopt;
+			if (mode == special_mode::exists || mode == special_mode::boolean || !is_number(str_view::from_str(s))) return std::nullopt;
+			const auto first = s.find_first_not_of(" \t\r");
+			if (first == std::string::npos || s[first] == '-' || s[first] == '+') return std::nullopt;
+			return lua_argument::kind::number;
+		}
+
+		static std::string add_argument(ini_parser_lua_params& args, lua_argument::kind type, std::vector<std::string> values)
+		{
+			args.expression_args.push_back({type, std::move(values)});
+			return SPECIAL_ARGUMENT + std::to_string(args.expression_args.size() - 1) + SPECIAL_ARGUMENT_END;
+		}
+
 		static bool all_numbers(const std::vector<std::string>& v)
 		{
 			for (const auto& s : v)
@@ -1557,7 +2907,7 @@ namespace utils
 			return true;
 		}
 
-		void substitute(const std::shared_ptr<variable_scope>& include_vars, const str_view& prefix, const str_view& postfix, bool& include_value,
+		void substitute(const scope_ref& include_vars, const str_view& prefix, const str_view& postfix, bool& include_value,
 			const value_finalizer& dest, const bool expr_mode)
 		{
 			std::vector<std::string> result;
@@ -1585,6 +2935,8 @@ namespace utils
 
 			if (expr_mode)
 			{
+				// Values are passed to expression as arguments, unless variable is outside of expression itself
+				const auto args = prefix.find(SPECIAL_END_STR) == std::string::npos ? dest.params->lua_params.get() : nullptr;
 				auto s = prefix.str();
 				if (result.empty())
 				{
@@ -1592,8 +2944,15 @@ namespace utils
 				}
 				else if (result.size() == 1)
 				{
-					wrap_auto(result[0]);
-					s += result[0];
+					if (const auto type = argument_type(result[0]); args && type)
+					{
+						s += add_argument(*args, *type, std::move(result));
+					}
+					else
+					{
+						wrap_auto(result[0]);
+						s += result[0];
+					}
 				}
 				else if (result.size() <= 4 && all_numbers(result))
 				{
@@ -1601,11 +2960,15 @@ namespace utils
 					for (auto j = 0, jt = int(result.size()); j < jt; j++)
 					{
 						if (j) s += ",";
-						wrap_if_not_a_number(result[j]);
-						s += result[j];
+						if (args) s += add_argument(*args, lua_argument::kind::number, {std::move(result[j])});
+						else s += result[j];
 					}
 					s += ")";
 				}
+				else if (args && std::ranges::all_of(result, is_passable))
+				{
+					s += add_argument(*args, lua_argument::kind::table, std::move(result));
+				}
 				else
 				{
 					s += "{";
@@ -1633,6 +2996,33 @@ namespace utils
 		}
 	};
 
+	static bool is_number_literal(const std::string& s)
+	{
+		return variable_info::is_number(str_view::from_str(s));
+	}
+
+	static std::string lua_argument_literal(const lua_argument& arg)
+	{
+		auto values = arg.values;
+		if (arg.type == lua_argument::kind::string)
+		{
+			variable_info::wrap(values[0]);
+			return values[0];
+		}
+		if (arg.type == lua_argument::kind::number)
+		{
+			return values[0];
+		}
+		std::string ret = "{";
+		for (auto j = 0, jt = int(values.size()); j < jt; j++)
+		{
+			if (j) ret += ",";
+			variable_info::wrap_if_not_a_number(values[j]);
+			ret += values[j];
+		}
+		return ret + "}";
+	}
+
 	inline int stoi(const str_view& s, int default_value, bool* set_ptr = nullptr)
 	{
 		#ifndef USE_SIMPLE
@@ -1720,7 +3110,23 @@ namespace utils
 		return variable_info{vname};
 	}
 
-	static void substitute_variable(const str_view& value, const std::shared_ptr<variable_scope>& include_vars, bool& include_value, const value_finalizer& dest,
+	// Expressions are calculated before outer substitution is done, so their arguments are no longer needed after it
+	struct lua_arguments_release
+	{
+		ini_parser_lua_params* params;
+		size_t mark;
+
+		explicit lua_arguments_release(ini_parser_lua_params* params) : params(params), mark(params ? params->expression_args.size() : 0) {}
+		lua_arguments_release(const lua_arguments_release& other) = delete;
+		lua_arguments_release& operator=(const lua_arguments_release& other) = delete;
+
+		~lua_arguments_release()
+		{
+			if (params) params->expression_args.resize(mark);
+		}
+	};
+
+	static void substitute_variable(const str_view& value, const scope_ref& include_vars, bool& include_value, const value_finalizer& dest,
 		const int stack, std::vector<std::string>* referenced_variables)
 	{
 		#if defined _DEBUG && defined USE_SIMPLE
@@ -1730,6 +3136,10 @@ namespace utils
 		}
 		#endif
 
+		// Only outer call is counted, recursive calls substitute results of the first one
+		stats_scope stats(stack == 0 ? dest.params->lua_params.get() : nullptr, ini_parser_stats::substitution, value.size());
+		lua_arguments_release release(stack == 0 ? dest.params->lua_params.get() : nullptr);
+
 		if (stack < 100)
 		{
 			auto var = check_variable(value, dest);
@@ -1769,141 +3179,690 @@ namespace utils
 			}
 
 			{
-				// Concatenation with $VariableName
-				const auto var_begin = value.find_first_of('$', 1U);
-				if (var_begin != std::string::npos)
+				// Concatenation with $VariableName
+				const auto var_begin = value.find_first_of('$', 1U);
+				if (var_begin != std::string::npos)
+				{
+					auto var_end = var_begin + 1;
+					for (auto i = var_begin + 1, s = size_t(value.size()); i < s; i++)
+					{
+						if (is_identifier_part(value[i])) var_end++;
+						else break;
+					}
+					if (var_end != var_begin + 1)
+					{
+						var = check_variable(value.substr(var_begin, var_end - var_begin), dest);
+						if (!var.name.empty() && referenced_variables) referenced_variables->push_back(var.name.str());
+						variant temp;
+						const auto finalizer = value_finalizer{var.name, include_value, temp, dest.params, false};
+						var.substitute(include_vars, value.substr(0, var_begin), value.substr(var_end), include_value, finalizer, expr_mode);
+						for (const auto& v : temp)
+						{
+							substitute_variable(v, include_vars, include_value, dest, stack + 1, referenced_variables);
+						}
+						return;
+					}
+				}
+			}
+		}
+
+		// Raw value
+		dest.add(value.str());
+	}
+
+	struct section_template
+	{
+		std::string name;
+		template_section values;
+		scope_ref template_scope;
+		std::vector<std::shared_ptr<section_template>> parents;
+		bool early_resolve{};
+
+		section_template(std::string name, const scope_ref& scope)
+			: name(std::move(name)), template_scope(scope.inherit())
+		{
+			template_scope.arena->pin(template_scope.id);
+			counters.templates++;
+		}
+
+		~section_template()
+		{
+			counters.templates--;
+		}
+	};
+
+	struct current_section_info
+	{
+		bool terminated{};
+		std::string section_key;
+		creating_section target_section{};
+		std::shared_ptr<section_template> target_template{};
+		std::vector<std::shared_ptr<section_template>> referenced_templates;
+		std::vector<std::string> referenced_variables;
+		std::vector<std::string> applied_mixins;
+
+		// This would allow to overwrite values by template
+		robin_hood::unordered_flat_map<section_template*, std::vector<std::string>> set_via_template;
+
+		explicit current_section_info(std::shared_ptr<section_template> target_template)
+			: target_template(std::move(target_template))
+		{
+			counters.current_sections++;
+		}
+
+		current_section_info(std::string key)
+			: section_key(std::move(key))
+		{
+			counters.current_sections++;
+		}
+
+		current_section_info(str_view key)
+			: section_key(key.data(), key.size())
+		{
+			counters.current_sections++;
+		}
+
+		current_section_info(std::string key, std::vector<std::shared_ptr<section_template>> templates)
+			: section_key(std::move(key)), referenced_templates(std::move(templates))
+		{
+			counters.current_sections++;
+		}
+
+		current_section_info(str_view key, std::vector<std::shared_ptr<section_template>> templates)
+			: section_key(key.data(), key.size()), referenced_templates(std::move(templates))
+		{
+			counters.current_sections++;
+		}
+
+		current_section_info(const current_section_info& other) = delete;
+		current_section_info& operator=(const current_section_info& other) = delete;
+
+		~current_section_info()
+		{
+			counters.current_sections--;
+		}
+
+		[[nodiscard]] bool section_mode() const { return target_template == nullptr && !terminated; }
+		void terminate() { terminated = true; }
+	};
+
+	// Sections being parsed, allocated from parser’s arena if it has one
+	struct section_info_deleter
+	{
+		bool from_arena{};
+
+		void operator()(current_section_info* ptr) const
+		{
+			if (from_arena) ptr->~current_section_info();
+			else delete ptr;
+		}
+	};
+
+	using section_info_ptr = std::unique_ptr<current_section_info, section_info_deleter>;
+
+	// File name folded to lower case and fingerprint of variables it was included with
+	struct processed_include
+	{
+		std::string name;
+		size_t vars_fingerprint;
+
+		static processed_include from(str_view file_name, size_t vars_fingerprint)
+		{
+			file_name.trim();
+			auto name = file_name.str();
+			const auto separator = name.find_last_of("/\\");
+			if (separator != std::string::npos) name.erase(0, separator + 1);
+			std::ranges::transform(name, name.begin(), tolower);
+			return {std::move(name), vars_fingerprint};
+		}
+	};
+
+	// Size and two unrelated hashes, so a changed file has to collide in both
+	struct content_digest
+	{
+		size_t size{};
+		size_t hash{};
+		uint64_t mix{};
+
+		static content_digest from(const char* data, size_t size)
+		{
+			content_digest ret{size, std::hash<std::string_view>{}(std::string_view{data, size}), 0x9e3779b97f4a7c15ULL};
+			for (size_t i = 0; i < size; i += 8)
+			{
+				uint64_t word{};
+				std::memcpy(&word, data + i, std::min<size_t>(8, size - i));
+				ret.mix = (ret.mix ^ word) * 0xff51afd7ed558ccdULL;
+				ret.mix ^= ret.mix >> 33;
+			}
+			return ret;
+		}
+
+		bool operator==(const content_digest& other) const = default;
+	};
+
+	// What parsing an included file added to parser state and what outside state it depended on
+	struct include_recording
+	{
+		struct scope_snapshot
+		{
+			int parent; // -1 for scope file was included within
+			creating_section explicit_values;
+			creating_section include_params;
+			creating_section default_values;
+		};
+
+		struct template_snapshot
+		{
+			std::string name;
+			bool is_mixin;
+			bool early_resolve;
+			int scope;
+			template_section values;
+			std::vector<std::string> parents;
+		};
+
+		struct diagnostic
+		{
+			path file;
+			std::string message;
+			bool is_error;
+		};
+
+		content_digest content_hash{};
+		size_t vars_fingerprint{};
+		uint32_t flags{};
+
+		std::vector<std::pair<std::string, size_t>> outer_variables;
+		std::vector<std::pair<path, content_digest>> nested_files;
+		std::vector<std::pair<processed_include, bool>> processed_queries;
+		std::vector<std::pair<std::string, bool>> outer_templates;
+		std::vector<std::string> missing_templates;
+
+		sections_list sections;
+		uint64_t key_autoinc_base{};
+		uint64_t key_autoinc_count{};
+		std::vector<processed_include> processed_files;
+		std::vector<path> resolve_within;
+		std::vector<scope_snapshot> scopes;
+		std::vector<template_snapshot> templates;
+		std::vector<diagnostic> diagnostics;
+		path last_file;
+		bool erase_referenced{};
+	};
+
+	// Active while included file is parsed, also catches its warnings and errors to repeat them later
+	struct include_recorder : ini_parser_error_handler
+	{
+		include_recording& rec;
+		ini_parser_error_handler* next;
+		size_t sections_start;
+		size_t processed_start;
+		uint64_t lua_runs_start;
+		std::vector<std::string> outer_lookups;
+		robin_hood::unordered_flat_set<const section_template*> created;
+		bool cacheable = true;
+
+		include_recorder(include_recording& rec, ini_parser_error_handler* next, size_t sections_start, size_t processed_start, uint64_t lua_runs_start)
+			: rec(rec), next(next), sections_start(sections_start), processed_start(processed_start), lua_runs_start(lua_runs_start) {}
+
+		void on_warning(const path& filename, const char* message) override
+		{
+			rec.diagnostics.push_back({filename, message, false});
+			if (next) next->on_warning(filename, message);
+		}
+
+		void on_error(const path& filename, const char* message) override
+		{
+			rec.diagnostics.push_back({filename, message, true});
+			if (next) next->on_error(filename, message);
+		}
+	};
+
+	// Same file named differently, to match changed files given to reparse() with files parser read
+	static std::string file_identity(const path& filename)
+	{
+		auto ret = utf8(std::filesystem::path(filename.wstring()).lexically_normal().wstring());
+		#ifdef _WIN32
+		for (auto& c : ret)
+		{
+			if (c == '/') c = '\\';
+			else c = char(tolower(uint8_t(c)));
+		}
+		#endif
+		return ret;
+	}
+
+	struct ini_parser_include_cache_data
+	{
+		using recording_ptr = std::shared_ptr<const include_recording>;
+
+		std::mutex mutex;
+		robin_hood::unordered_node_map<std::string, std::vector<recording_ptr>> entries;
+		size_t max_variants;
+		std::atomic<size_t> hits{};
+		std::atomic<size_t> misses{};
+
+		explicit ini_parser_include_cache_data(size_t max_variants) : max_variants(max_variants) {}
+
+		std::vector<recording_ptr> candidates(const std::string& key, const content_digest& content_hash, size_t vars_fingerprint, uint32_t flags)
+		{
+			std::vector<recording_ptr> ret;
+			std::unique_lock lock(mutex);
+			if (const auto f = entries.find(key); f != entries.end())
+			{
+				for (const auto& e : f->second)
+				{
+					if (e->content_hash == content_hash && e->vars_fingerprint == vars_fingerprint && e->flags == flags)
+					{
+						ret.push_back(e);
+					}
+				}
+			}
+			return ret;
+		}
+
+		void store(const std::string& key, recording_ptr recording)
+		{
+			std::unique_lock lock(mutex);
+			auto& list = entries[key];
+			list.push_back(std::move(recording));
+			if (list.size() > max_variants) list.erase(list.begin());
+		}
+
+		// Drops recordings of changed files and of files including them, directly or not
+		void invalidate(const robin_hood::unordered_flat_set<std::string>& changed)
+		{
+			std::unique_lock lock(mutex);
+			for (auto i = entries.begin(); i != entries.end();)
+			{
+				auto& list = i->second;
+				if (changed.count(file_identity(i->first))) list.clear();
+				else
 				{
-					auto var_end = var_begin + 1;
-					for (auto i = var_begin + 1, s = size_t(value.size()); i < s; i++)
-					{
-						if (is_identifier_part(value[i])) var_end++;
-						else break;
-					}
-					if (var_end != var_begin + 1)
+					std::erase_if(list, [&](const recording_ptr& r)
 					{
-						var = check_variable(value.substr(var_begin, var_end - var_begin), dest);
-						if (!var.name.empty() && referenced_variables) referenced_variables->push_back(var.name.str());
-						variant temp;
-						const auto finalizer = value_finalizer{var.name, include_value, temp, dest.params, false};
-						var.substitute(include_vars, value.substr(0, var_begin), value.substr(var_end), include_value, finalizer, expr_mode);
-						for (const auto& v : temp)
-						{
-							substitute_variable(v, include_vars, include_value, dest, stack + 1, referenced_variables);
-						}
-						return;
-					}
+						return std::ranges::any_of(r->nested_files, [&](const auto& n) { return changed.count(file_identity(n.first)) != 0; });
+					});
 				}
+				if (list.empty()) i = entries.erase(i);
+				else ++i;
 			}
 		}
+	};
 
-		// Raw value
-		dest.add(value.str());
-	}
-
-	struct section_template
+	struct ini_parser_path_cache_data
 	{
-		std::string name;
-		template_section values;
-		std::shared_ptr<variable_scope> template_scope;
-		std::vector<std::shared_ptr<section_template>> parents;
-		bool early_resolve{};
+		struct directory_listing
+		{
+			std::filesystem::file_time_type modified;
+			robin_hood::unordered_flat_set<std::string> names;
+		};
+
+		std::mutex mutex;
+		robin_hood::unordered_node_map<std::string, directory_listing> directories;
+		robin_hood::unordered_flat_set<std::string> found;
+		std::atomic<size_t> hits{};
+		std::atomic<size_t> listed{};
 
-		section_template(std::string name, const std::shared_ptr<variable_scope>& scope)
-			: name(std::move(name)), template_scope(scope->inherit())
+		// Same paths differing only in case or in kind of slashes are the same file on Windows
+		static std::string key(std::string value)
 		{
-			counters.templates++;
+			#ifdef _WIN32
+			for (auto& c : value)
+			{
+				if (c == '/') c = '\\';
+				else c = char(tolower(uint8_t(c)));
+			}
+			#endif
+			return value;
 		}
 
-		~section_template()
+		static std::filesystem::path native(const path& directory)
 		{
-			counters.templates--;
+			return directory.empty() ? std::filesystem::path(".") : std::filesystem::path(directory.wstring());
 		}
-	};
 
-	struct current_section_info
-	{
-		bool terminated{};
-		std::string section_key;
-		creating_section target_section{};
-		std::shared_ptr<section_template> target_template{};
-		std::vector<std::shared_ptr<section_template>> referenced_templates;
-		std::vector<std::string> referenced_variables;
+		static std::filesystem::file_time_type modified(const path& directory)
+		{
+			std::error_code ec;
+			const auto ret = std::filesystem::last_write_time(native(directory), ec);
+			return ec ? std::filesystem::file_time_type::min() : ret;
+		}
 
-		// This would allow to overwrite values by template
-		robin_hood::unordered_flat_map<section_template*, std::vector<std::string>> set_via_template;
+		static directory_listing list(const path& directory)
+		{
+			directory_listing ret{modified(directory)};
+			std::error_code ec;
+			for (std::filesystem::directory_iterator i(native(directory), ec), end; !ec && i != end; i.increment(ec))
+			{
+				ret.names.insert(key(utf8(i->path().filename().wstring())));
+			}
+			return ret;
+		}
 
-		explicit current_section_info(std::shared_ptr<section_template> target_template)
-			: target_template(std::move(target_template))
+		// Misses are checked against listing, which is refreshed once directory changes
+		bool exists(const path& filename)
 		{
-			counters.current_sections++;
+			const auto file_key = key(filename.string());
+			std::unique_lock lock(mutex);
+			if (found.count(file_key) != 0)
+			{
+				++hits;
+				return true;
+			}
+
+			const auto directory = filename.parent_path();
+			const auto directory_key = key(directory.string());
+			auto listing = directories.find(directory_key);
+			if (listing == directories.end())
+			{
+				listing = directories.emplace(directory_key, list(directory)).first;
+				++listed;
+			}
+			else if (listing->second.modified != modified(directory))
+			{
+				listing->second = list(directory);
+				++listed;
+			}
+			else
+			{
+				++hits;
+			}
+			if (listing->second.names.count(key(filename.filename().string())) == 0) return false;
+			found.insert(file_key);
+			return true;
 		}
 
-		current_section_info(std::string key)
-			: section_key(std::move(key))
+		void forget(const std::vector<path>& changed_files)
 		{
-			counters.current_sections++;
+			robin_hood::unordered_flat_set<std::string> changed_directories;
+			for (const auto& f : changed_files)
+			{
+				changed_directories.insert(key(f.parent_path().string()));
+			}
+			std::unique_lock lock(mutex);
+			for (const auto& d : changed_directories)
+			{
+				directories.erase(d);
+			}
+			for (auto i = found.begin(); i != found.end();)
+			{
+				if (changed_directories.count(key(path(*i).parent_path().string())) != 0) i = found.erase(i);
+				else ++i;
+			}
 		}
 
-		current_section_info(str_view key)
-			: section_key(key.data(), key.size())
+		void clear()
 		{
-			counters.current_sections++;
+			std::unique_lock lock(mutex);
+			directories.clear();
+			found.clear();
 		}
+	};
 
-		current_section_info(std::string key, std::vector<std::shared_ptr<section_template>> templates)
-			: section_key(std::move(key)), referenced_templates(std::move(templates))
+	// Owned by parser: static destructors joining process-wide threads deadlock when a DLL unloads
+	struct include_io_pool
+	{
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::deque<std::packaged_task<void()>> tasks;
+		std::vector<std::thread> threads;
+		const size_t max_threads = std::clamp(std::thread::hardware_concurrency(), 1U, 4U);
+		size_t idle{};
+		bool stopping{};
+
+		include_io_pool() = default;
+		include_io_pool(const include_io_pool&) = delete;
+		include_io_pool& operator=(const include_io_pool&) = delete;
+
+		~include_io_pool()
 		{
-			counters.current_sections++;
+			{
+				std::unique_lock lock(mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			for (auto& t : threads) t.join();
 		}
 
-		current_section_info(str_view key, std::vector<std::shared_ptr<section_template>> templates)
-			: section_key(key.data(), key.size()), referenced_templates(std::move(templates))
+		void work()
 		{
-			counters.current_sections++;
+			for (;;)
+			{
+				std::packaged_task<void()> task;
+				{
+					std::unique_lock lock(mutex);
+					++idle;
+					wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+					--idle;
+					if (tasks.empty()) return;
+					task = std::move(tasks.front());
+					tasks.pop_front();
+				}
+				task();
+			}
 		}
 
-		current_section_info(const current_section_info& other) = delete;
-		current_section_info& operator=(const current_section_info& other) = delete;
+		std::shared_future<void> run(std::function<void()> fn)
+		{
+			std::packaged_task<void()> task(std::move(fn));
+			auto ret = task.get_future().share();
+			{
+				std::unique_lock lock(mutex);
+				tasks.push_back(std::move(task));
+				if (idle == 0 && threads.size() < max_threads) threads.emplace_back([this] { work(); });
+			}
+			wake.notify_one();
+			return ret;
+		}
+	};
 
-		~current_section_info()
+	// Prefetched data is dropped if include resolves to another path by the time it’s parsed
+	struct include_prefetch
+	{
+		struct entry
 		{
-			counters.current_sections--;
+			std::vector<std::shared_future<void>> reads;
+			std::vector<std::pair<std::string, ini_parser_view>> results;
+		};
+
+		std::mutex mutex;
+		robin_hood::unordered_node_map<std::string, entry> entries;
+
+		// Last, so that threads are joined before entries they fill go away
+		include_io_pool pool;
+
+		include_prefetch() = default;
+		include_prefetch(const include_prefetch&) = delete;
+		include_prefetch& operator=(const include_prefetch&) = delete;
+
+		~include_prefetch()
+		{
+			for (auto& e : entries)
+			{
+				for (auto& r : e.second.reads) r.wait();
+			}
 		}
 
-		[[nodiscard]] bool section_mode() const { return target_template == nullptr && !terminated; }
-		void terminate() { terminated = true; }
+		void start(const std::string& file_name, std::vector<path> directories, const ini_parser_reader* reader,
+			ini_parser_path_cache_data* path_cache)
+		{
+			const auto key = processed_include::from(str_view::from_str(file_name), 0).name;
+			std::unique_lock lock(mutex);
+			auto& e = entries[key];
+			if (!e.reads.empty()) return;
+			e.reads.push_back(pool.run([=, this]
+			{
+				for (const auto& d : directories)
+				{
+					auto filename = d / file_name;
+					if (!(path_cache ? path_cache->exists(filename) : exists(filename))) continue;
+					auto data = reader->read_view(filename);
+					std::unique_lock result_lock(mutex);
+					entries[key].results.emplace_back(filename.string(), std::move(data));
+					return;
+				}
+			}));
+		}
+
+		std::optional<ini_parser_view> take(const path& filename)
+		{
+			const auto key = processed_include::from(str_view::from_str(filename.filename().string()), 0).name;
+			std::vector<std::shared_future<void>> reads;
+			{
+				std::unique_lock lock(mutex);
+				const auto f = entries.find(key);
+				if (f == entries.end()) return std::nullopt;
+				reads = f->second.reads;
+			}
+			for (auto& r : reads) r.wait();
+
+			std::unique_lock lock(mutex);
+			const auto f = entries.find(key);
+			if (f == entries.end()) return std::nullopt;
+			std::optional<ini_parser_view> ret;
+			const auto target = filename.string();
+			for (auto& r : f->second.results)
+			{
+				if (r.first == target) ret = std::move(r.second);
+			}
+			entries.erase(f);
+			return ret;
+		}
 	};
 
 	struct ini_parser_data
 	{
+		scope_arena scopes;
+		std::unique_ptr<std::pmr::monotonic_buffer_resource> arena;
 		sections_list sections;
-		sections_map sections_map;
+		utils::sections_map sections_map;
 		robin_hood::unordered_flat_map<std::string, std::shared_ptr<section_template>> templates_map;
 		robin_hood::unordered_flat_map<std::string, std::shared_ptr<section_template>> mixins_map;
 		std::vector<path> resolve_within;
-		std::vector<std::string> processed_files;
+
+		// Files parsed so far, and position of the first one for each name and fingerprint
+		struct processed_id
+		{
+			uint32_t name;
+			size_t vars_fingerprint;
+
+			bool operator==(const processed_id& other) const
+			{
+				return name == other.name && vars_fingerprint == other.vars_fingerprint;
+			}
+		};
+
+		struct processed_id_hash
+		{
+			size_t operator()(const processed_id& id) const noexcept
+			{
+				return robin_hood::hash<uint64_t>{}(uint64_t(id.vars_fingerprint) ^ uint64_t(id.name) * 0x9e3779b97f4a7c15ULL);
+			}
+		};
+
+		std::vector<processed_id> processed_files;
+		robin_hood::unordered_flat_map<processed_id, int, processed_id_hash> processed_positions;
+		robin_hood::unordered_node_map<std::string, uint32_t> processed_names;
+		std::vector<const std::string*> processed_names_list;
 		// section include_vars;
 		// variable_scope main_scope{nullptr};
 		script_params current_params;
 		const ini_parser_reader* reader{};
 		uint64_t key_autoinc_index{};
+		ini_parser_include_cache* include_cache{};
+		ini_parser_path_cache* path_cache{};
+		std::vector<include_recorder*> recorders;
+
+		// Current file is the last one of include_stack
+		std::unique_ptr<ini_parser_provenance> provenance;
+		robin_hood::unordered_flat_map<std::string, uint32_t> provenance_files;
+		std::vector<uint32_t> include_stack;
+		uint32_t current_line{};
+		const section_template* current_generator{};
+
+		// Kept for reparse() once enable_reparse() is called
+		struct parsed_input
+		{
+			bool is_file;
+			path file;
+			std::string data;
+		};
+
+		bool reparse_enabled{};
+		std::vector<parsed_input> inputs;
+		std::vector<path> initial_resolve_within;
+		std::unique_ptr<ini_parser_include_cache> own_include_cache;
+
+		// Last, so that reads still running finish before anything else goes away
+		std::unique_ptr<include_prefetch> prefetch;
+
+		uint32_t record_origin(const current_section_info* c, const std::vector<std::string>* referenced_variables)
+		{
+			ini_parser_provenance::origin o;
+			if (!include_stack.empty())
+			{
+				o.file = include_stack.back();
+				o.included_from.assign(include_stack.begin(), include_stack.end() - 1);
+			}
+			o.line = current_line;
+			if (c)
+			{
+				for (const auto& t : c->referenced_templates) o.templates.push_back(t->name);
+				o.mixins = c->applied_mixins;
+			}
+			if (current_generator) o.generator = current_generator->name;
+			if (referenced_variables)
+			{
+				o.variables = *referenced_variables;
+				std::ranges::sort(o.variables);
+				o.variables.erase(std::unique(o.variables.begin(), o.variables.end()), o.variables.end());
+			}
+			provenance->origins.push_back(std::move(o));
+			return uint32_t(provenance->origins.size() - 1);
+		}
+
+		void push_section(const current_section_info& c, const std::vector<std::string>* referenced_variables)
+		{
+			sections.push_back({c.section_key, c.target_section});
+			if (provenance) sections.back().second.set_origin(record_origin(&c, referenced_variables));
+		}
+
+		// Starts reading included file without variables in its name as soon as it’s lexed
+		void prefetch_include(str_view file_name)
+		{
+			if (!prefetch || !reader) return;
+			file_name.trim();
+			const auto name = file_name.str();
+			if (name.empty() || name.find_first_of("$,[") != std::string::npos) return;
+
+			std::vector<path> directories;
+			directories.reserve(resolve_within.size() + 1);
+			directories.push_back(current_params.file.parent_path());
+			directories.insert(directories.end(), resolve_within.begin(), resolve_within.end());
+			prefetch->start(name, std::move(directories), reader, path_cache ? path_cache->data_ : nullptr);
+		}
 
-		std::shared_ptr<section_template> get_or_create_template(const std::string& s, const std::shared_ptr<variable_scope>& scope)
+		std::shared_ptr<section_template> get_or_create_template(const std::string& s, const scope_ref& scope)
 		{
 			const auto f = templates_map.find(s);
 			if (f == templates_map.end())
 			{
-				return templates_map[s] = std::make_shared<section_template>(s, scope);
+				auto& created = templates_map[s] = std::make_shared<section_template>(s, scope);
+				for (const auto r : recorders) r->created.insert(created.get());
+				return created;
 			}
 			return f->second;
 		}
 
-		std::shared_ptr<section_template> get_or_create_mixin(const std::string& s, const std::shared_ptr<variable_scope>& scope)
+		std::shared_ptr<section_template> get_or_create_mixin(const std::string& s, const scope_ref& scope)
 		{
 			const auto f = mixins_map.find(s);
 			if (f == mixins_map.end())
 			{
-				return mixins_map[s] = std::make_shared<section_template>(s, scope);
+				auto& created = mixins_map[s] = std::make_shared<section_template>(s, scope);
+				for (const auto r : recorders) r->created.insert(created.get());
+				return created;
 			}
 			return f->second;
 		}
@@ -1911,6 +3870,7 @@ namespace utils
 		bool get_template(const std::string& s, std::shared_ptr<section_template>& ref)
 		{
 			ref = templates_map[s];
+			track_template(ref, false, true);
 			if (!ref) error("Template is missing: %s", s);
 			return ref != nullptr;
 		}
@@ -1918,10 +3878,22 @@ namespace utils
 		bool get_mixin(const std::string& s, std::shared_ptr<section_template>& ref)
 		{
 			ref = mixins_map[s];
+			track_template(ref, true, true);
 			if (!ref) error("Mixin is missing: %s", s);
 			return ref != nullptr;
 		}
 
+		// Includes needing contents of outer templates can’t be cached
+		void track_template(const std::shared_ptr<section_template>& t, bool is_mixin, bool uses_contents)
+		{
+			for (const auto r : recorders)
+			{
+				if (t && r->created.count(t.get())) continue;
+				if (!t || uses_contents) r->cacheable = false;
+				else r->rec.outer_templates.emplace_back(t->name, is_mixin);
+			}
+		}
+
 		static auto warn_unwrap(const std::string& s) { return s.c_str(); }
 
 		static auto warn_unwrap(const str_view& s)
@@ -1953,40 +3925,106 @@ namespace utils
 			: resolve_within(std::move(resolve_within)), current_params(&sections)
 		{
 			current_params.allow_includes = allow_includes;
+			initial_resolve_within = this->resolve_within;
 		}
 
-		bool is_processed(str_view file_name, const size_t vars_fingerprint)
+		template <typename... Args>
+		section_info_ptr make_section_info(Args&&... args)
 		{
-			file_name.trim();
-			const auto name = path(file_name.str()).filename().string() + std::to_string(vars_fingerprint);
-			for (auto& processed_value : processed_files)
+			if (!arena) return section_info_ptr(new current_section_info(std::forward<Args>(args)...));
+			const auto ptr = arena->allocate(sizeof(current_section_info), alignof(current_section_info));
+			return section_info_ptr(new(ptr) current_section_info(std::forward<Args>(args)...), {true});
+		}
+
+		// New state to parse the same inputs again, with the same settings and caches, minus what changed files affect
+		ini_parser_data* restart(const std::vector<path>& changed_files)
+		{
+			robin_hood::unordered_flat_set<std::string> changed;
+			for (const auto& f : changed_files)
 			{
-				if (_stricmp(processed_value.c_str(), name.c_str()) == 0)
-				{
-					return true;
-				}
+				changed.insert(file_identity(f));
 			}
-			return false;
+			if (include_cache && !changed.empty()) include_cache->data_->invalidate(changed);
+			if (path_cache) path_cache->data_->forget(changed_files);
+
+			const auto ret = new ini_parser_data(current_params.allow_includes, initial_resolve_within);
+			auto& lua_params = *ret->current_params.lua_params;
+			lua_params.error_handler = current_params.lua_params->error_handler;
+			lua_params.data_provider = current_params.lua_params->data_provider;
+			lua_params.stats = current_params.lua_params->stats;
+			lua_params.pool = current_params.lua_params->pool;
+			lua_params.instructions_limit = current_params.lua_params->instructions_limit;
+			lua_params.memory_limit = current_params.lua_params->memory_limit;
+			ret->current_params.allow_lua = current_params.allow_lua;
+			ret->current_params.ignore_inactive = current_params.ignore_inactive;
+			ret->reader = reader;
+			ret->include_cache = include_cache;
+			ret->path_cache = path_cache;
+			ret->own_include_cache = std::move(own_include_cache);
+			ret->reparse_enabled = true;
+			ret->inputs = std::move(inputs);
+			if (provenance) ret->provenance = std::make_unique<ini_parser_provenance>();
+			if (prefetch) ret->prefetch = std::make_unique<include_prefetch>();
+			if (arena) ret->arena = std::make_unique<std::pmr::monotonic_buffer_resource>();
+			ret->scopes.recycle = scopes.recycle;
+			return ret;
 		}
 
-		void mark_processed(str_view file_name, const size_t vars_fingerprint)
+		int processed_index(const processed_include& key) const
 		{
-			file_name.trim();
-			const auto name = path(file_name.str()).filename().string() + std::to_string(vars_fingerprint);
-			processed_files.push_back(name);
+			const auto name = processed_names.find(key.name);
+			if (name == processed_names.end()) return -1;
+			const auto found = processed_positions.find({name->second, key.vars_fingerprint});
+			return found == processed_positions.end() ? -1 : found->second;
 		}
 
-		path find_referenced(str_view file_name, const size_t vars_fingerprint)
+		void mark_processed(const processed_include& key)
+		{
+			auto name = processed_names.find(key.name);
+			if (name == processed_names.end())
+			{
+				name = processed_names.emplace(key.name, uint32_t(processed_names_list.size())).first;
+				processed_names_list.push_back(&name->first);
+			}
+			const processed_id id{name->second, key.vars_fingerprint};
+			processed_positions.emplace(id, int(processed_files.size()));
+			processed_files.push_back(id);
+		}
+
+		processed_include processed_key(const processed_id& id) const
+		{
+			return {*processed_names_list[id.name], id.vars_fingerprint};
+		}
+
+		bool file_exists(const path& filename) const
 		{
-			if (is_processed(file_name, vars_fingerprint)) return {};
+			return path_cache ? path_cache->data_->exists(filename) : exists(filename);
+		}
 
+		path find_referenced(str_view file_name, const size_t vars_fingerprint)
+		{
 			file_name.trim();
+			const auto key = processed_include::from(file_name, vars_fingerprint);
+			const auto processed = processed_index(key);
+			for (const auto r : recorders)
+			{
+				// Files processed by recorded include itself don’t depend on anything outside of it
+				if (processed < int(r->processed_start)) r->rec.processed_queries.emplace_back(key, processed != -1);
+			}
+			if (processed != -1) return {};
+
 			for (auto i = -1, t = int(resolve_within.size()); i < t; i++)
 			{
 				auto filename = (i == -1 ? current_params.file.parent_path() : resolve_within[i]) / file_name.str();
-				if (!exists(filename)) continue;
+				if (!file_exists(filename)) continue;
 
 				const auto new_resolve_within = filename.parent_path();
+				for (const auto r : recorders)
+				{
+					// Files found next to included one are fine, others depend on where it was included from
+					if (i == -1) r->rec.resolve_within.push_back(new_resolve_within);
+					else r->cacheable = false;
+				}
 				auto add_new_resolve_within = true;
 				for (auto& within : resolve_within)
 				{
@@ -2005,6 +4043,7 @@ namespace utils
 				return filename;
 			}
 
+			for (const auto r : recorders) r->cacheable = false;
 			return {};
 		}
 
@@ -2023,7 +4062,7 @@ namespace utils
 			return c && (equals(c->section_key, "DEFAULTS") || equals(c->section_key, "INCLUDE") || c->target_template);
 		}
 
-		bool substitute_variable_array(const std::string& key, const variant& v, const std::shared_ptr<variable_scope>& sc,
+		bool substitute_variable_array(const std::string& key, const variant& v, const scope_ref& sc,
 			std::vector<std::string>* referenced_variables, variant& result)
 		{
 			auto include_value_ret = true;
@@ -2041,7 +4080,7 @@ namespace utils
 			return include_value_ret;
 		}
 
-		bool split_and_substitute(const std::string& key, current_section_info* c, const str_view& value, const std::shared_ptr<variable_scope>& sc,
+		bool split_and_substitute(const std::string& key, current_section_info* c, const str_view& value, const scope_ref& sc,
 			std::vector<std::string>* referenced_variables, variant& result)
 		{
 			const auto split = split_string_quotes(value, !key.empty() && key[0] == '@');
@@ -2056,35 +4095,141 @@ namespace utils
 			return r;
 		}
 
+		// Generator parameters are values like “@GENERATOR:Param = …” set next to generator itself
+		static bool get_generator_param(const std::string& key, const std::string& value_key, std::string& param_key)
+		{
+			if (value_key.find(key) != 0) return false;
+			const auto sep = value_key.find_first_of(':');
+			if (sep == std::string::npos) return false;
+			for (auto j = key.size(); j < sep; j++)
+			{
+				if (!is_whitespace(value_key[j])) return false;
+			}
+			param_key = value_key.substr(sep + 1);
+			trim_self(param_key);
+			return true;
+		}
+
+		// Per parameter position, then per iteration; empty for iterations calculated the usual way
+		struct generator_batch
+		{
+			std::vector<std::vector<std::optional<variant>>> values;
+			size_t iteration{};
+		};
+
+		// Expressions depending only on iteration indices are calculated for all iterations with one Lua call
+		void prepare_generator_batch(const std::shared_ptr<section_template>& t, const std::string& key,
+			const std::shared_ptr<section_template>& tpl, const scope_ref& scope, std::vector<std::string>& referenced_variables,
+			const std::vector<int>& repeats, generator_batch& batch)
+		{
+			auto& lua_params = *current_params.lua_params;
+			if (!t || !current_params.allow_lua || lua_params.collector
+				|| lua_params.custom_lua || lua_params.chunks.statements_loaded) return;
+
+			size_t iterations = 1;
+			for (const auto r : repeats)
+			{
+				if (r <= 0) return;
+				iterations *= size_t(r);
+				if (iterations > size_t(SPECIAL_RANGE_LIMIT)) return;
+			}
+			if (iterations < 2) return;
+
+			std::vector<std::pair<size_t, std::string>> params;
+			for (size_t i = 0; i < t->values.size(); i++)
+			{
+				std::string param_key;
+				if (get_generator_param(key, t->values[i].first, param_key)) params.emplace_back(i, std::move(param_key));
+			}
+
+			std::vector<int> offsets(repeats.size(), 1);
+			const auto starting = gen_find(tpl->values, "@GENERATOR_STARTING_INDEX");
+			if (starting != tpl->values.end())
+			{
+				for (size_t p = 0; p < repeats.size(); p++)
+				{
+					offsets[p] = starting->second.as<int>(int(p));
+				}
+			}
+
+			for (const auto& param : params)
+			{
+				const auto& value = t->values[param.first].second;
+				std::string text;
+				for (size_t i = 0, n = value.size(); i < n; i++)
+				{
+					text += value.at(i).str();
+					text.push_back('\n');
+				}
+				if (!contains(text, SPECIAL_CALCULATE_STR)) continue;
+
+				auto independent = true;
+				for (const auto& other : params)
+				{
+					if (&other != &param && contains(text, other.second)) independent = false;
+				}
+				if (!independent) continue;
+
+				lua_batch_collector collector;
+				std::vector<std::optional<variant>> collected(iterations);
+				lua_params.collector = &collector;
+				for (size_t i = 0; i < iterations && !collector.failed; i++)
+				{
+					scope_release release(scopes);
+					auto iteration_scope = scope.inherit();
+					auto rest = i;
+					for (auto p = repeats.size(); p-- > 0;)
+					{
+						const auto n = size_t(repeats[p]);
+						iteration_scope->explicit_values.set(std::to_string(p + 1), variant{int(rest % n) + offsets[p]});
+						rest /= n;
+					}
+
+					variant v;
+					if (substitute_variable_array(param.second, value, iteration_scope, &referenced_variables, v))
+					{
+						collected[i] = std::move(v);
+					}
+				}
+				lua_params.collector = nullptr;
+				if (collector.failed || collector.calls.empty()) continue;
+
+				std::vector<std::optional<variant>> results;
+				lua_calculate_batch(collector, lua_params, results);
+				batch.values.resize(t->values.size());
+				auto& values = batch.values[param.first];
+				values.resize(iterations);
+				for (size_t i = 0; i < iterations; i++)
+				{
+					if (collected[i]) values[i] = lua_batch_fill(*collected[i], results);
+				}
+			}
+		}
+
 		void resolve_generator_impl(const std::shared_ptr<section_template>& t, const std::string& key, const std::string& section_key,
-			const std::shared_ptr<section_template>& tpl, const std::shared_ptr<variable_scope>& scope, std::vector<std::string>& referenced_variables)
+			const std::shared_ptr<section_template>& tpl, const scope_ref& scope, std::vector<std::string>& referenced_variables,
+			generator_batch* batch)
 		{
 			current_section_info generated(section_key, {});
 			add_template(generated.referenced_templates, tpl);
 
 			auto gen_scope = scope;
-			auto gen_param_prefix = key + ":";
 			if (t)
 			{
-				for (const auto& v0 : t->values)
+				for (size_t i = 0; i < t->values.size(); i++)
 				{
-					if (v0.first.find(key) != 0) continue;
-					const auto v0_sep = v0.first.find_first_of(':');
-					if (v0_sep == std::string::npos) continue;
-					auto is_param = true;
-					for (auto j = key.size(); j < v0_sep; j++)
+					const auto& v0 = t->values[i];
+					std::string param_key;
+					if (!get_generator_param(key, v0.first, param_key)) continue;
+					if (gen_scope == scope)
 					{
-						if (!is_whitespace(v0.first[j]))
-						{
-							is_param = false;
-						}
+						gen_scope = scope.inherit();
 					}
-					if (!is_param) continue;
-					auto param_key = v0.first.substr(v0_sep + 1);
-					trim_self(param_key);
-					if (gen_scope == scope)
+
+					if (batch && i < batch->values.size() && !batch->values[i].empty() && batch->values[i][batch->iteration])
 					{
-						gen_scope = scope->inherit();
+						gen_scope->explicit_values.set(param_key, *batch->values[i][batch->iteration]);
+						continue;
 					}
 
 					variant v;
@@ -2094,12 +4239,16 @@ namespace utils
 					}
 				}
 			}
+			if (batch) batch->iteration++;
+			const auto outer_generator = current_generator;
+			current_generator = tpl.get();
 			parse_ini_section_finish(generated, gen_scope, &referenced_variables);
+			current_generator = outer_generator;
 		}
 
 		void resolve_generator_iteration(const std::shared_ptr<section_template>& t, const std::string& key, const std::string& section_key,
-			const std::shared_ptr<section_template>& tpl, const std::shared_ptr<variable_scope>& scope, std::vector<std::string>& referenced_variables,
-			const std::vector<int>& repeats, size_t repeats_phase)
+			const std::shared_ptr<section_template>& tpl, const scope_ref& scope, std::vector<std::string>& referenced_variables,
+			const std::vector<int>& repeats, size_t repeats_phase, generator_batch* batch)
 		{
 			if (repeats.size() > repeats_phase)
 			{
@@ -2112,18 +4261,19 @@ namespace utils
 
 				for (auto i = 0, n = repeats[repeats_phase]; i < n; i++)
 				{
-					auto gen_scope = scope->inherit();
+					scope_release release(scopes);
+					auto gen_scope = scope.inherit();
 					gen_scope->explicit_values.set(std::to_string(repeats_phase + 1), variant{i + o});
-					resolve_generator_iteration(t, key, section_key, tpl, gen_scope, referenced_variables, repeats, repeats_phase + 1);
+					resolve_generator_iteration(t, key, section_key, tpl, gen_scope, referenced_variables, repeats, repeats_phase + 1, batch);
 				}
 			}
 			else
 			{
-				resolve_generator_impl(t, key, section_key, tpl, scope, referenced_variables);
+				resolve_generator_impl(t, key, section_key, tpl, scope, referenced_variables, batch);
 			}
 		}
 
-		void set_inline_values(std::shared_ptr<variable_scope>& scope_own, const std::shared_ptr<variable_scope>& scope,
+		void set_inline_values(scope_ref& scope_own, const scope_ref& scope,
 			const variant& trigger, const int index, std::vector<std::string>& referenced_variables)
 		{
 			for (auto i = index; i < int(trigger.size()); i++)
@@ -2134,7 +4284,7 @@ namespace utils
 				{
 					if (!scope_own)
 					{
-						scope_own = scope->inherit();
+						scope_own = scope.inherit();
 					}
 
 					auto set_key = str_view{item, 0, uint32_t(set)};
@@ -2165,7 +4315,7 @@ namespace utils
 				{
 					if (!scope_own)
 					{
-						scope_own = scope->inherit();
+						scope_own = scope.inherit();
 					}
 					scope_own->explicit_values.set(item.str(), variant(true));
 				}
@@ -2173,10 +4323,12 @@ namespace utils
 		}
 
 		void resolve_generator(const std::shared_ptr<section_template>& t, const std::string& key, const variant& trigger,
-			const std::shared_ptr<variable_scope>& scope, std::vector<std::string>& referenced_variables)
+			const scope_ref& scope, std::vector<std::string>& referenced_variables)
 		{
+			stats_scope stats(*current_params.lua_params, ini_parser_stats::generators);
+			scope_release release(scopes);
 			auto ref_template = trigger.as<std::string>();
-			std::shared_ptr<variable_scope> scope_own;
+			scope_ref scope_own;
 			set_inline_values(scope_own, scope, trigger, 1, referenced_variables);
 
 			std::vector<int> repeats;
@@ -2203,16 +4355,20 @@ namespace utils
 			std::shared_ptr<section_template> tpl;
 			if (get_template(ref_template, tpl))
 			{
-				resolve_generator_iteration(t, key, section_key, tpl, scope_own ? scope_own : scope, referenced_variables, repeats, 0);
+				const auto& iteration_scope = scope_own ? scope_own : scope;
+				generator_batch batch;
+				prepare_generator_batch(t, key, tpl, iteration_scope, referenced_variables, repeats, batch);
+				resolve_generator_iteration(t, key, section_key, tpl, iteration_scope, referenced_variables, repeats, 0,
+					batch.values.empty() ? nullptr : &batch);
 			}
 		}
 
-		static std::shared_ptr<variable_scope> prepare_section_scope(current_section_info& c, const std::shared_ptr<variable_scope>& scope)
+		static scope_ref prepare_section_scope(current_section_info& c, const scope_ref& scope)
 		{
-			auto sc = scope->inherit(&c.target_section);
+			auto sc = scope.inherit(&c.target_section);
 			for (const auto& t : c.referenced_templates)
 			{
-				sc->fallback(t->template_scope);
+				sc.fallback(t->template_scope);
 			}
 
 			const auto target_found = sc->explicit_values.find("TARGET");
@@ -2223,11 +4379,13 @@ namespace utils
 			return sc;
 		}
 
-		void resolve_template(current_section_info& c, const std::shared_ptr<variable_scope>& scope, const std::shared_ptr<section_template>& t,
+		void resolve_template(current_section_info& c, const scope_ref& scope, const std::shared_ptr<section_template>& t,
 			std::vector<std::string>& referenced_variables, bool within_template)
 		{
-			const auto sc = scope->inherit();
-			sc->fallback(t->template_scope);
+			stats_scope stats(*current_params.lua_params, ini_parser_stats::templates);
+			scope_release release(scopes);
+			const auto sc = scope.inherit();
+			sc.fallback(t->template_scope);
 
 			if (const auto inactive = gen_find(t->values, "@ACTIVE"); inactive != t->values.end())
 			{
@@ -2302,28 +4460,31 @@ namespace utils
 			}
 		}
 
-		void resolve_mixin(current_section_info& c, const std::shared_ptr<variable_scope>& sc, const std::string& mixin_name, const variant& trigger,
+		void resolve_mixin(current_section_info& c, const scope_ref& sc, const std::string& mixin_name, const variant& trigger,
 			int inline_values_index, bool within_template)
 		{
 			std::shared_ptr<section_template> t;
 			if (!get_mixin(mixin_name, t)) return;
+			if (provenance) c.applied_mixins.push_back(mixin_name);
 
-			std::shared_ptr<variable_scope> scope_own;
+			scope_release release(scopes);
+			scope_ref scope_own;
 			set_inline_values(scope_own, sc, trigger, inline_values_index, c.referenced_variables);
 			resolve_template(c, scope_own ? scope_own : sc, t, c.referenced_variables, within_template);
 		}
 
-		void resolve_mixin(current_section_info& c, const std::shared_ptr<variable_scope>& sc, const variant& trigger, bool within_template)
+		void resolve_mixin(current_section_info& c, const scope_ref& sc, const variant& trigger, bool within_template)
 		{
 			if (trigger.empty()) return;
 			resolve_mixin(c, sc, trigger.at(0).str(), trigger, 1, within_template);
 		}
 
-		void parse_ini_section_finish(current_section_info& c, const std::shared_ptr<variable_scope>& scope,
+		void parse_ini_section_finish(current_section_info& c, const scope_ref& scope,
 			std::vector<std::string>* referenced_variables_ptr = nullptr)
 		{
 			if (!c.section_mode()) return;
 
+			scope_release release(scopes);
 			if (!c.referenced_templates.empty())
 			{
 				std::unique_ptr<std::vector<std::string>> referenced_variables_uptr;
@@ -2387,7 +4548,7 @@ namespace utils
 							c.target_section.set("ACTIVE", variant{false});
 							if (!is_system)
 							{
-								sections.push_back({c.section_key, c.target_section});
+								push_section(c, referenced_variables_ptr ? referenced_variables_ptr : &c.referenced_variables);
 							}
 							return;
 						}
@@ -2398,17 +4559,17 @@ namespace utils
 			if (equals(c.section_key, "FUNCTION") && current_params.allow_lua)
 			{
 				lua_register_function(
-					c.target_section.get("NAME").as<std::string>(),
-					c.target_section.get("ARGUMENTS"),
-					c.target_section.get("CODE").as<std::string>(),
+					c.target_section.value("NAME").as<std::string>(),
+					c.target_section.value("ARGUMENTS"),
+					c.target_section.value("CODE").as<std::string>(),
 					current_params.file, *current_params.lua_params);
 				c.target_section.clear();
 			}
 			else if (equals(c.section_key, "USE") && current_params.allow_lua)
 			{
-				const auto name = c.target_section.get("FILE").at(0);
+				const auto name = c.target_section.value("FILE").at(0);
 				const auto referenced = find_referenced(name, 0);
-				if (exists(referenced)) lua_import(referenced, current_params.file, *current_params.lua_params);
+				if (!referenced.empty()) lua_import(referenced, current_params.file, *current_params.lua_params);
 				else error("Referenced file is missing: %s", name.str());
 				c.target_section.clear();
 			}
@@ -2418,9 +4579,9 @@ namespace utils
 				if (to_include != c.target_section.end())
 				{
 					const auto previous_file = current_params.file;
-					auto include_scope = scope->inherit();
+					auto include_scope = scope.inherit();
 
-					for (const auto& p : c.target_section.values)
+					for (const auto& p : std::as_const(c.target_section))
 					{
 						if (equals(p.first, "INCLUDE")) continue;
 						if (starts_with(p.first, "VAR")) include_scope->include_params.set(p.second.as<std::string>(), p.second.as<variant>(1));
@@ -2437,7 +4598,7 @@ namespace utils
 						const auto vars_fp = include_scope->include_params.fingerprint();
 						for (const auto& i : values)
 						{
-							parse_file(find_referenced(i, vars_fp), include_scope, vars_fp);
+							parse_include(find_referenced(i, vars_fp), include_scope, vars_fp);
 						}
 						current_params.file = previous_file;
 					}
@@ -2447,7 +4608,7 @@ namespace utils
 
 			if (!c.target_section.empty())
 			{
-				sections.push_back({c.section_key, c.target_section});
+				push_section(c, referenced_variables_ptr ? referenced_variables_ptr : &c.referenced_variables);
 			}
 		}
 
@@ -2559,12 +4720,13 @@ namespace utils
 			return variant{pieces};
 		}
 
-		void parse_ini_finish(current_section_info& c, const std::string& data, const int non_space, str_view& key_view,
-			const int started, const std::shared_ptr<variable_scope>& scope)
+		void parse_ini_finish(current_section_info& c, const str_view& data, const int non_space, str_view& key_view,
+			const int started, const scope_ref& scope)
 		{
 			if (!c.section_mode() && !c.target_template) return;
 			if (key_view.empty()) return;
 
+			scope_release release(scopes);
 			str_view value;
 			if (started != -1)
 			{
@@ -2625,6 +4787,7 @@ namespace utils
 					for (const auto& piece : splitted)
 					{
 						existing.push_back(piece.str());
+						prefetch_include(piece);
 					}
 				}
 				else if (new_key)
@@ -2664,8 +4827,8 @@ namespace utils
 			bool started_solid{};
 		};
 
-		void parse_ini_finish(std::vector<std::unique_ptr<current_section_info>>& cs, const std::string& data, const int non_space,
-			parse_status& status, const bool finish_section, const std::shared_ptr<variable_scope>& scope)
+		void parse_ini_finish(std::vector<section_info_ptr>& cs, const str_view& data, const int non_space,
+			parse_status& status, const bool finish_section, const scope_ref& scope)
 		{
 			for (auto& s : cs)
 			{
@@ -2705,10 +4868,11 @@ namespace utils
 		creating_section& create_section(const std::string& final_name)
 		{
 			sections.push_back({final_name, {}});
+			if (provenance) sections.back().second.set_origin(record_origin(nullptr, nullptr));
 			return sections[sections.size() - 1].second;
 		}
 
-		void set_sections(std::vector<std::unique_ptr<current_section_info>>& cs, str_view cs_keys, const std::shared_ptr<variable_scope>& scope)
+		void set_sections(std::vector<section_info_ptr>& cs, str_view cs_keys, const scope_ref& scope)
 		{
 			str_view final_name;
 			auto is_template = false;
@@ -2722,8 +4886,9 @@ namespace utils
 				{
 					auto file = cs_keys.substr(uint32_t(separator + 1));
 					file.trim();
-					cs.push_back(std::make_unique<current_section_info>(final_name));
+					cs.push_back(make_section_info(final_name));
 					for (const auto& s : cs) s->target_section.set("INCLUDE", file);
+					prefetch_include(file);
 					return;
 				}
 
@@ -2731,7 +4896,7 @@ namespace utils
 				{
 					auto file = cs_keys.substr(uint32_t(separator + 1));
 					file.trim();
-					cs.push_back(std::make_unique<current_section_info>(final_name));
+					cs.push_back(make_section_info(final_name));
 					for (const auto& s : cs) s->target_section.set("NAME", file);
 					return;
 				}
@@ -2740,7 +4905,7 @@ namespace utils
 				{
 					auto file = cs_keys.substr(uint32_t(separator + 1));
 					file.trim();
-					cs.push_back(std::make_unique<current_section_info>(final_name));
+					cs.push_back(make_section_info(final_name));
 					for (const auto& s : cs) s->target_section.set("FILE", file);
 					return;
 				}
@@ -2754,6 +4919,7 @@ namespace utils
 			{
 				auto pieces = cs_keys.split(' ', true, true);
 				auto tpl = get_or_create_template(pieces[0].str(), scope);
+				track_template(tpl, false, true);
 				if (pieces.size() > 1 && (pieces[pieces.size() - 1] == "earlyresolve" || pieces[pieces.size() - 1] == "EARLYRESOLVE"))
 				{
 					tpl->early_resolve = true;
@@ -2765,9 +4931,10 @@ namespace utils
 					{
 						pieces[k].trim(", \t\r");
 						tpl->parents.push_back(get_or_create_template(pieces[k].str(), scope));
+						track_template(tpl->parents.back(), false, false);
 					}
 				}
-				cs.push_back(std::make_unique<current_section_info>(tpl));
+				cs.push_back(make_section_info(tpl));
 				return;
 			}
 
@@ -2775,15 +4942,17 @@ namespace utils
 			{
 				auto pieces = cs_keys.split(' ', true, true);
 				auto tpl = get_or_create_mixin(pieces[0].str(), scope);
+				track_template(tpl, true, true);
 				if (pieces.size() > 2 && (pieces[1] == "extends" || pieces[1] == "EXTENDS"))
 				{
 					for (auto k = 2U, kt = uint32_t(pieces.size()); k < kt; ++k)
 					{
 						pieces[k].trim(", \t\r");
 						tpl->parents.push_back(get_or_create_mixin(pieces[k].str(), scope));
+						track_template(tpl->parents.back(), true, false);
 					}
 				}
-				cs.push_back(std::make_unique<current_section_info>(tpl));
+				cs.push_back(make_section_info(tpl));
 				return;
 			}
 
@@ -2807,19 +4976,24 @@ namespace utils
 				auto found_template = templates_map.find(*section_name);
 				if (found_template != templates_map.end())
 				{
-					add_template(referenced_early_templates, referenced_late_templates, found_template->second);
+					track_template(found_template->second, false, true);
+					add_template(referenced_early_templates, referenced_late_templates, found_template->second);
+				}
+				else
+				{
+					for (const auto r : recorders) r->rec.missing_templates.push_back(*section_name);
 				}
 			}
 
 			if (!referenced_late_templates.empty())
 			{
-				cs.push_back(std::make_unique<current_section_info>(final_name, std::move(referenced_late_templates)));
+				cs.push_back(make_section_info(final_name, std::move(referenced_late_templates)));
 			}
 			else
 			{
 				for (auto& cs_key : section_names_str)
 				{
-					cs.push_back(std::make_unique<current_section_info>(std::move(cs_key)));
+					cs.push_back(make_section_info(std::move(cs_key)));
 				}
 			}
 
@@ -2843,27 +5017,38 @@ namespace utils
 				const auto c = data[i];
 				if (is_whitespace(c)) continue;
 				if (allow_$ && c == '$') return is_quote_working(data, from, i, false);
-				return c == ',' && (data[i - 1] != '\\' || data[i - 2] == '\\');
+				return c == ',' && (i == 0 || data[i - 1] != '\\' || i > 1 && data[i - 2] == '\\');
 			}
 			return true;
 		}
 
-		void parse_ini_values(const std::string& data, const std::shared_ptr<variable_scope>& parent_scope)
+		void parse_ini_values(const str_view& data, const scope_ref& parent_scope)
 		{
-			std::vector<std::unique_ptr<current_section_info>> cs;
-			const auto scope = parent_scope ? parent_scope->inherit() : std::make_shared<variable_scope>();
+			stats_scope stats(*current_params.lua_params, ini_parser_stats::lexing, data.size());
+			std::vector<section_info_ptr> cs;
+			scope_release release(scopes);
+			const auto scope = parent_scope ? parent_scope.inherit() : scope_ref{&scopes, scopes.create()};
 
 			parse_status status;
 			auto non_space = -1;
 			auto consume_comment = false;
 
+			// Lines are only counted up to section headers, and only if provenance is recorded
+			const auto outer_line = current_line;
+			auto counted_until = 0;
+			current_line = 1;
+
+			const auto data_ptr = data.data();
 			const auto data_size = int(data.size());
 			for (auto i = 0; i < data_size; i++)
 			{
 				const auto c = data[i];
 				if (consume_comment || is_whitespace(c) || status.end_at != -1 && c != status.end_at)
 				{
+					// Comments last until the end of line, quoted values until their closing quote
 					if (c == '\n') consume_comment = false;
+					else if (consume_comment) i = scan_char(data_ptr, i + 1, data_size, '\n') - 1;
+					else if (status.end_at != -1) i = scan_char(data_ptr, i + 1, data_size, char(status.end_at)) - 1;
 				}
 				else if (c == '\n' && !(non_space > 0 && data[non_space] == '\\'))
 				{
@@ -2871,6 +5056,7 @@ namespace utils
 				}
 				else if (status.started_solid)
 				{
+					i = scan_solid_run(data_ptr, i + 1, data_size) - 1;
 					non_space = i;
 				}
 				else if (c == ';' || c == '/' && i + 1 < data_size && data[i + 1] == '/')
@@ -2881,9 +5067,14 @@ namespace utils
 				else if (c == '[')
 				{
 					parse_ini_finish(cs, data, non_space, status, true, scope);
+					if (provenance)
+					{
+						current_line += uint32_t(std::count(data_ptr + counted_until, data_ptr + i, '\n'));
+						counted_until = i;
+					}
 					const auto s = ++i;
 					if (s == data_size) continue;
-					for (; i < data_size && data[i] != ']'; i++) {}
+					i = scan_char(data_ptr, i, data_size, ']');
 					cs.clear();
 					set_sections(cs, str_view{data, uint32_t(s), uint32_t(i - s)}, scope);
 				}
@@ -2901,11 +5092,11 @@ namespace utils
 				{
 					if ((c == '"' || c == '\'') && !status.key.empty())
 					{
-						if (c == status.end_at && (data[i - 1] != '\\' || data[i - 2] == '\\'))
+						if (c == status.end_at && (data[i - 1] != '\\' || i > 1 && data[i - 2] == '\\'))
 						{
 							status.end_at = -1;
 						}
-						else if (status.end_at == -1 && (status.started == -1 || is_quote_working(data.c_str(), status.started, i)))
+						else if (status.end_at == -1 && (status.started == -1 || is_quote_working(data.data(), status.started, i)))
 						{
 							status.end_at = c;
 							if (status.started == -1)
@@ -2919,31 +5110,313 @@ namespace utils
 					if (status.started == -1)
 					{
 						status.started = i;
-						status.started_solid = c == 'd' && is_solid({data, uint32_t(i), UINT_MAX});
+						status.started_solid = c == 'd' && is_solid({data, uint32_t(i), uint32_t(data_size - i)});
+					}
+					if (c != '"' && c != '\'')
+					{
+						// Rest of plain value run would only move non_space forward
+						i = scan_value_run(data_ptr, i + 1, data_size) - 1;
+						non_space = i;
 					}
 				}
 			}
 
 			parse_ini_finish(cs, data, non_space, status, true, scope);
+			current_line = outer_line;
+		}
+
+		static content_digest content_hash(const ini_parser_view& data)
+		{
+			return content_digest::from(data.data, data.size);
+		}
+
+		ini_parser_view read_file(const path& path)
+		{
+			stats_scope stats(*current_params.lua_params, ini_parser_stats::includes);
+			auto prefetched = prefetch ? prefetch->take(path) : std::nullopt;
+			auto ret = prefetched ? std::move(*prefetched) : reader->read_view(path);
+			stats.add_bytes(ret.size);
+			if (!recorders.empty())
+			{
+				const auto hash = content_hash(ret);
+				for (const auto r : recorders) r->rec.nested_files.emplace_back(path, hash);
+			}
+			return ret;
 		}
 
-		void parse_file(const path& path, const std::shared_ptr<variable_scope>& scope, const size_t vars_fingerprint)
+		void parse_file(const path& path, const scope_ref& scope, const size_t vars_fingerprint)
 		{
 			if (path.empty() || !reader) return;
-			mark_processed(str_view::from_str(path.filename().string()), vars_fingerprint);
+			parse_file(path, read_file(path), scope, vars_fingerprint);
+		}
+
+		void parse_file(const path& path, const ini_parser_view& data, const scope_ref& scope, const size_t vars_fingerprint)
+		{
+			mark_processed(processed_include::from(str_view::from_str(path.filename().string()), vars_fingerprint));
 			current_params.file = path;
-			const auto data = reader->read(path);
 			if (data.empty() && current_params.lua_params->error_handler)
 			{
 				warn("File is missing or empty: %s", path.string());
 			}
-			parse_ini_values(data, scope);
+			if (provenance)
+			{
+				const auto file = provenance_files.emplace(path.string(), uint32_t(provenance->files.size()));
+				if (file.second) provenance->files.push_back(path);
+				include_stack.push_back(file.first->second);
+			}
+			parse_ini_values(str_view{data.data, 0ULL, data.size}, scope);
+			if (provenance) include_stack.pop_back();
+		}
+
+		uint32_t include_flags() const
+		{
+			return uint32_t(current_params.allow_includes)
+				| uint32_t(current_params.allow_override) << 1
+				| uint32_t(current_params.allow_lua) << 2
+				| uint32_t(current_params.ignore_inactive) << 3
+				| uint32_t(current_params.erase_referenced) << 4
+				| uint32_t(current_params.lua_params->error_handler != nullptr) << 5;
+		}
+
+		// Nested includes are parsed as usual, outer recording covers them
+		void parse_include(const path& path, const scope_ref& include_scope, const size_t vars_fingerprint)
+		{
+			if (!include_cache || !recorders.empty() || provenance)
+			{
+				parse_file(path, include_scope, vars_fingerprint);
+				return;
+			}
+
+			if (path.empty() || !reader) return;
+			const auto data = read_file(path);
+			const auto cache = include_cache->data_;
+			const auto key = path.string();
+			const auto hash = content_hash(data);
+			const auto flags = include_flags();
+			for (const auto& c : cache->candidates(key, hash, vars_fingerprint, flags))
+			{
+				if (is_replayable(*c, include_scope))
+				{
+					++cache->hits;
+					replay_include(*c, include_scope);
+					return;
+				}
+			}
+
+			++cache->misses;
+			auto recording = std::make_shared<include_recording>();
+			recording->content_hash = hash;
+			recording->vars_fingerprint = vars_fingerprint;
+			recording->flags = flags;
+			recording->key_autoinc_base = key_autoinc_index;
+
+			const auto handler = current_params.lua_params->error_handler;
+			include_recorder recorder(*recording, handler, sections.size(), processed_files.size(), current_params.lua_params->lua_runs);
+			if (handler) current_params.lua_params->error_handler = &recorder;
+			include_scope->outer_lookups = &recorder.outer_lookups;
+			recorders.push_back(&recorder);
+			parse_file(path, data, include_scope, vars_fingerprint);
+			recorders.pop_back();
+			include_scope->outer_lookups = nullptr;
+			current_params.lua_params->error_handler = handler;
+
+			if (finish_recording(recorder, include_scope))
+			{
+				cache->store(key, std::move(recording));
+			}
+		}
+
+		int snapshot_scope(include_recording& rec, robin_hood::unordered_flat_map<scope_id, int>& indices, scope_id id, scope_id boundary) const
+		{
+			if (id == boundary) return -1;
+			if (id == scope_arena::none) return -2;
+			const auto& s = scopes.items[id];
+			if (s.target_section || !s.local_fallbacks.empty()) return -2;
+			if (const auto f = indices.find(id); f != indices.end()) return f->second;
+			const auto parent = snapshot_scope(rec, indices, s.parent, boundary);
+			if (parent == -2) return -2;
+			rec.scopes.push_back({parent, s.explicit_values, s.include_params, s.default_values});
+			return indices[id] = int(rec.scopes.size() - 1);
+		}
+
+		bool snapshot_templates(include_recording& rec, const include_recorder& recorder, robin_hood::unordered_flat_map<scope_id, int>& indices,
+			const robin_hood::unordered_flat_map<std::string, std::shared_ptr<section_template>>& map, bool is_mixin, scope_id boundary) const
+		{
+			for (const auto& p : map)
+			{
+				const auto& t = p.second;
+				if (!t || !recorder.created.count(t.get())) continue;
+
+				// Template scope is always empty and is only used as fallback, so only its parent is stored
+				const auto& ts = *t->template_scope;
+				if (ts.target_section || !ts.local_fallbacks.empty() || !ts.explicit_values.empty() || !ts.include_params.empty() || !ts.default_values.empty())
+				{
+					return false;
+				}
+
+				const auto scope = snapshot_scope(rec, indices, ts.parent, boundary);
+				if (scope == -2) return false;
+
+				include_recording::template_snapshot snapshot{t->name, is_mixin, t->early_resolve, scope, t->values, {}};
+				for (const auto& parent : t->parents)
+				{
+					if (!parent) return false;
+					snapshot.parents.push_back(parent->name);
+				}
+				rec.templates.push_back(std::move(snapshot));
+			}
+			return true;
+		}
+
+		bool finish_recording(include_recorder& recorder, const scope_ref& include_scope)
+		{
+			// Lua might use or change anything, and its state is not a part of recording either
+			if (!recorder.cacheable || current_params.lua_params->lua_runs != recorder.lua_runs_start) return false;
+
+			auto& rec = recorder.rec;
+			auto& names = recorder.outer_lookups;
+			std::ranges::sort(names);
+			names.erase(std::unique(names.begin(), names.end()), names.end());
+			for (auto& name : names)
+			{
+				const auto fingerprint = scopes.lookup_fingerprint(include_scope->parent, name);
+				rec.outer_variables.emplace_back(std::move(name), fingerprint);
+			}
+
+			robin_hood::unordered_flat_map<scope_id, int> indices;
+			if (!snapshot_templates(rec, recorder, indices, templates_map, false, include_scope.id)
+				|| !snapshot_templates(rec, recorder, indices, mixins_map, true, include_scope.id))
+			{
+				return false;
+			}
+
+			rec.sections.assign(sections.begin() + ptrdiff_t(recorder.sections_start), sections.end());
+			rec.key_autoinc_count = key_autoinc_index - rec.key_autoinc_base;
+			rec.processed_files.clear();
+			for (auto i = recorder.processed_start; i < processed_files.size(); i++)
+			{
+				rec.processed_files.push_back(processed_key(processed_files[i]));
+			}
+			rec.last_file = current_params.file;
+			rec.erase_referenced = current_params.erase_referenced;
+			return true;
+		}
+
+		bool is_replayable(const include_recording& rec, const scope_ref& include_scope) const
+		{
+			for (const auto& t : rec.templates)
+			{
+				if ((t.is_mixin ? mixins_map : templates_map).count(t.name)) return false;
+			}
+			for (const auto& t : rec.outer_templates)
+			{
+				const auto& map = t.second ? mixins_map : templates_map;
+				const auto f = map.find(t.first);
+				if (f == map.end() || !f->second) return false;
+			}
+			for (const auto& t : rec.missing_templates)
+			{
+				if (templates_map.count(t)) return false;
+			}
+			for (const auto& q : rec.processed_queries)
+			{
+				if ((processed_index(q.first) != -1) != q.second) return false;
+			}
+			for (const auto& v : rec.outer_variables)
+			{
+				if (scopes.lookup_fingerprint(include_scope->parent, v.first) != v.second) return false;
+			}
+			for (const auto& f : rec.nested_files)
+			{
+				if (content_hash(reader->read_view(f.first)) != f.second) return false;
+			}
+			return true;
+		}
+
+		static void shift_key_autoinc(creating_section& section, uint64_t from, uint64_t to)
+		{
+			creating_section ret;
+			for (auto& p : section)
+			{
+				const auto x = p.first.find(SPECIAL_KEY_AUTOINCREMENT);
+				if (x == std::string::npos)
+				{
+					ret.set(p.first, std::move(p.second));
+					continue;
+				}
+
+				const auto prefix_size = x + SPECIAL_KEY_AUTOINCREMENT.size();
+				const auto index = std::strtoull(&p.first[prefix_size], nullptr, 10);
+				ret.set(p.first.substr(0, prefix_size) + std::to_string(index - from + to), std::move(p.second));
+			}
+			section = std::move(ret);
+		}
+
+		void replay_include(const include_recording& rec, const scope_ref& include_scope)
+		{
+			stats_scope stats(*current_params.lua_params, ini_parser_stats::includes);
+			for (const auto& s : rec.sections)
+			{
+				sections.push_back(s);
+				if (rec.key_autoinc_base != key_autoinc_index)
+				{
+					shift_key_autoinc(sections.back().second, rec.key_autoinc_base, key_autoinc_index);
+				}
+			}
+			key_autoinc_index += rec.key_autoinc_count;
+			for (const auto& f : rec.processed_files)
+			{
+				mark_processed(f);
+			}
+			for (const auto& r : rec.resolve_within)
+			{
+				if (std::ranges::find(resolve_within, r) == resolve_within.end()) resolve_within.push_back(r);
+			}
+
+			std::vector<scope_ref> created_scopes;
+			created_scopes.reserve(rec.scopes.size());
+			for (const auto& s : rec.scopes)
+			{
+				auto& created = created_scopes.emplace_back((s.parent == -1 ? include_scope : created_scopes[s.parent]).inherit());
+				created->explicit_values = s.explicit_values;
+				created->include_params = s.include_params;
+				created->default_values = s.default_values;
+			}
+
+			for (const auto& t : rec.templates)
+			{
+				auto created = std::make_shared<section_template>(t.name, t.scope == -1 ? include_scope : created_scopes[t.scope]);
+				created->early_resolve = t.early_resolve;
+				created->values = t.values;
+				(t.is_mixin ? mixins_map : templates_map)[t.name] = std::move(created);
+			}
+			for (const auto& t : rec.templates)
+			{
+				auto& map = t.is_mixin ? mixins_map : templates_map;
+				auto& parents = map[t.name]->parents;
+				for (const auto& p : t.parents)
+				{
+					parents.push_back(map[p]);
+				}
+			}
+
+			if (const auto handler = current_params.lua_params->error_handler)
+			{
+				for (const auto& d : rec.diagnostics)
+				{
+					if (d.is_error) handler->on_error(d.file, d.message.c_str());
+					else handler->on_warning(d.file, d.message.c_str());
+				}
+			}
+
+			current_params.file = rec.last_file;
+			current_params.erase_referenced = rec.erase_referenced;
 		}
 
-		static resulting_section resolve_sequential_keys(creating_section& s)
+		static resulting_section resolve_sequential_keys(creating_section& s, ini_parser_provenance::section_entry* provenance)
 		{
 			resulting_section ret;
-			for (auto& p : s.values)
+			for (auto& p : s)
 			{
 				const auto x = p.first.find(SPECIAL_KEY_AUTOINCREMENT);
 				if (x == std::string::npos)
@@ -2958,6 +5431,15 @@ namespace utils
 					auto cand = g + std::to_string(i);
 					if (ret.find(cand) == ret.end() && s.find(cand) == s.end())
 					{
+						if (provenance)
+						{
+							if (const auto f = provenance->values.find(p.first); f != provenance->values.end())
+							{
+								const auto origin = f->second;
+								provenance->values.erase(f);
+								provenance->values[cand] = origin;
+							}
+						}
 						ret[cand] = std::move(p.second);
 						break;
 					}
@@ -2966,12 +5448,24 @@ namespace utils
 			return ret;
 		}
 
+		// Sections are merged in order, so later ones override values of earlier ones
+		void track_provenance(const std::string& key, const creating_section& section)
+		{
+			auto& entry = provenance->sections[key];
+			const auto origin = section.origin();
+			if (origin != ini_parser_provenance::none) entry.origins.push_back(origin);
+			for (const auto& v : section)
+			{
+				entry.values[v.first] = origin;
+			}
+		}
+
 		void resolve_sequential_add(robin_hood::unordered_flat_map<std::string, creating_section*>& temp_map, const std::string& key, creating_section& section) const
 		{
 			auto existing = temp_map.find(key);
 			if (existing != temp_map.end())
 			{
-				for (auto& r : section.values)
+				for (auto& r : section)
 				{
 					existing->second->set(r.first, std::move(r.second));
 				}
@@ -3012,6 +5506,7 @@ namespace utils
 
 		void resolve_sequential()
 		{
+			stats_scope stats(*current_params.lua_params, ini_parser_stats::sequential);
 			robin_hood::unordered_flat_map<size_t, taken_indices> indices;
 			robin_hood::unordered_flat_map<std::string, creating_section*> temp_map;
 
@@ -3029,26 +5524,92 @@ namespace utils
 				}
 			}
 
+			if (provenance) provenance->sections.clear();
 			for (auto& p : sections)
 			{
 				str_view group_us;
-				if (is_sequential(p.first, group_us))
-				{
-					resolve_sequential_add(temp_map, group_us.str() + std::to_string(indices[group_us.hash_code()].next()), p.second);
-				}
-				else
-				{
-					resolve_sequential_add(temp_map, p.first, p.second);
-				}
+				const auto key = is_sequential(p.first, group_us) ? group_us.str() + std::to_string(indices[group_us.hash_code()].next()) : p.first;
+				if (provenance) track_provenance(key, p.second);
+				resolve_sequential_add(temp_map, key, p.second);
 			}
 
 			for (auto& p : temp_map)
 			{
-				sections_map[p.first] = resolve_sequential_keys(*p.second);
+				sections_map[p.first] = resolve_sequential_keys(*p.second, provenance ? &provenance->sections[p.first] : nullptr);
 			}
 		}
 	};
 
+	ini_parser_include_cache::ini_parser_include_cache(size_t max_variants_per_file)
+		: data_(new ini_parser_include_cache_data(max_variants_per_file)) { }
+
+	ini_parser_include_cache::~ini_parser_include_cache()
+	{
+		delete data_;
+	}
+
+	void ini_parser_include_cache::clear()
+	{
+		std::unique_lock lock(data_->mutex);
+		data_->entries.clear();
+	}
+
+	size_t ini_parser_include_cache::hits() const
+	{
+		return data_->hits;
+	}
+
+	size_t ini_parser_include_cache::misses() const
+	{
+		return data_->misses;
+	}
+
+	ini_parser_lua_pool::ini_parser_lua_pool(size_t max_idle)
+		: data_(new ini_parser_lua_pool_data(max_idle)) { }
+
+	ini_parser_lua_pool::~ini_parser_lua_pool()
+	{
+		delete data_;
+	}
+
+	void ini_parser_lua_pool::clear()
+	{
+		data_->clear();
+	}
+
+	size_t ini_parser_lua_pool::created() const
+	{
+		return data_->created;
+	}
+
+	size_t ini_parser_lua_pool::reused() const
+	{
+		return data_->reused;
+	}
+
+	ini_parser_path_cache::ini_parser_path_cache()
+		: data_(new ini_parser_path_cache_data()) { }
+
+	ini_parser_path_cache::~ini_parser_path_cache()
+	{
+		delete data_;
+	}
+
+	void ini_parser_path_cache::clear()
+	{
+		data_->clear();
+	}
+
+	size_t ini_parser_path_cache::hits() const
+	{
+		return data_->hits;
+	}
+
+	size_t ini_parser_path_cache::listed_directories() const
+	{
+		return data_->listed;
+	}
+
 	ini_parser::ini_parser(): data_(new ini_parser_data()) { }
 
 	ini_parser::ini_parser(bool allow_includes, const std::vector<path>& resolve_within)
@@ -3077,6 +5638,72 @@ namespace utils
 		return *this;
 	}
 
+	ini_parser& ini_parser::set_stats_sink(ini_parser_stats* stats)
+	{
+		data_->current_params.lua_params->stats = stats;
+		return *this;
+	}
+
+	ini_parser& ini_parser::set_include_cache(ini_parser_include_cache* cache)
+	{
+		data_->include_cache = cache;
+		return *this;
+	}
+
+	ini_parser& ini_parser::set_lua_pool(ini_parser_lua_pool* pool)
+	{
+		data_->current_params.lua_params->pool = pool;
+		return *this;
+	}
+
+	ini_parser& ini_parser::set_path_cache(ini_parser_path_cache* cache)
+	{
+		data_->path_cache = cache;
+		return *this;
+	}
+
+	ini_parser& ini_parser::record_provenance(bool value)
+	{
+		if (!value) data_->provenance.reset();
+		else if (!data_->provenance) data_->provenance = std::make_unique<ini_parser_provenance>();
+		return *this;
+	}
+
+	ini_parser& ini_parser::prefetch_includes(bool value)
+	{
+		if (!value) data_->prefetch.reset();
+		else if (!data_->prefetch) data_->prefetch = std::make_unique<include_prefetch>();
+		return *this;
+	}
+
+	ini_parser& ini_parser::use_arena(bool value)
+	{
+		data_->scopes.recycle = value;
+		if (!value) data_->arena.reset();
+		else if (!data_->arena) data_->arena = std::make_unique<std::pmr::monotonic_buffer_resource>();
+		return *this;
+	}
+
+	ini_parser& ini_parser::enable_reparse()
+	{
+		data_->reparse_enabled = true;
+		if (!data_->include_cache)
+		{
+			data_->own_include_cache = std::make_unique<ini_parser_include_cache>();
+			data_->include_cache = data_->own_include_cache.get();
+		}
+		return *this;
+	}
+
+	ini_parser& ini_parser::set_lua_limits(uint64_t max_instructions, size_t max_memory)
+	{
+		const auto& lua_params = data_->current_params.lua_params;
+		lua_params->instructions_limit = max_instructions;
+		lua_params->memory_limit = max_memory;
+		if (lua_params->lua_ptr) lua_params->apply_limits(true);
+		return *this;
+	}
+
 	ini_parser& ini_parser::allow_lua(const bool value)
 	{
 		data_->current_params.allow_lua = value;
@@ -3091,22 +5718,43 @@ namespace utils
 
 	const ini_parser& ini_parser::parse(const char* data, const int data_size) const
 	{
-		data_->parse_ini_values(std::string(data, data_size), {nullptr});
+		if (data_->reparse_enabled) data_->inputs.push_back({false, {}, std::string(data, size_t(data_size))});
+		data_->parse_ini_values(str_view{data, 0ULL, size_t(data_size)}, {nullptr});
 		return *this;
 	}
 
 	const ini_parser& ini_parser::parse(const std::string& data) const
 	{
-		data_->parse_ini_values(data, {nullptr});
+		if (data_->reparse_enabled) data_->inputs.push_back({false, {}, data});
+		data_->parse_ini_values(str_view::from_str(data), {nullptr});
 		return *this;
 	}
 
 	const ini_parser& ini_parser::parse_file(const path& path) const
 	{
+		if (data_->reparse_enabled) data_->inputs.push_back({true, path, {}});
 		data_->parse_file(path, {nullptr}, 0);
 		return *this;
 	}
 
+	const ini_parser& ini_parser::reparse(const std::vector<path>& changed_files)
+	{
+		if (!data_->reparse_enabled)
+		{
+			data_->error("Call enable_reparse() before parsing to use reparse()");
+			return *this;
+		}
+		const auto fresh = data_->restart(changed_files);
+		delete data_;
+		data_ = fresh;
+		for (const auto& input : data_->inputs)
+		{
+			if (input.is_file) data_->parse_file(input.file, {nullptr}, 0);
+			else data_->parse_ini_values(str_view::from_str(input.data), {nullptr});
+		}
+		return *this;
+	}
+
 	const ini_parser& ini_parser::finalize() const
 	{
 		finalize_end();
@@ -3290,6 +5938,66 @@ namespace utils
 		return data_->sections_map;
 	}
 
+	const ini_parser_provenance* ini_parser::get_provenance() const
+	{
+		return data_->provenance.get();
+	}
+
+	std::string ini_parser_provenance::to_json(bool format) const
+	{
+		using namespace nlohmann;
+		auto result = json::object();
+		auto& files_list = result["files"] = json::array();
+		for (const auto& f : files)
+		{
+			files_list.push_back(f.string());
+		}
+
+		const auto strings = [](const std::vector<std::string>& v)
+		{
+			auto ret = json::array();
+			for (const auto& s : v) ret.push_back(s);
+			return ret;
+		};
+
+		auto& origins_list = result["origins"] = json::array();
+		for (const auto& o : origins)
+		{
+			auto item = json::object();
+			if (o.file != none) item["file"] = o.file;
+			item["line"] = o.line;
+			if (!o.included_from.empty())
+			{
+				auto& included_from = item["included_from"] = json::array();
+				for (const auto f : o.included_from) included_from.push_back(f);
+			}
+			if (!o.templates.empty()) item["templates"] = strings(o.templates);
+			if (!o.mixins.empty()) item["mixins"] = strings(o.mixins);
+			if (!o.generator.empty()) item["generator"] = o.generator;
+			if (!o.variables.empty()) item["variables"] = strings(o.variables);
+			origins_list.push_back(item);
+		}
+
+		auto& sections_list = result["sections"] = json::object();
+		for (const auto& s : sections)
+		{
+			auto& item = sections_list[s.first] = json::object();
+			auto& section_origins = item["origins"] = json::array();
+			for (const auto o : s.second.origins) section_origins.push_back(o);
+			auto& values = item["values"] = json::object();
+			for (const auto& v : s.second.values)
+			{
+				if (v.second == none) values[v.first] = nullptr;
+				else values[v.first] = v.second;
+			}
+		}
+
+		std::stringstream r;
+		if (format) r << std::setw(2) << result << '\n';
+		else r << result << '\n';
+		return r.str();
+	}
+
 	std::string ini_parser::to_ini(const sections_map& sections, const serializer_params& params)
 	{
 		return gen_to_ini(sections, params);
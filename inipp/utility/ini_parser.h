@@ -7,10 +7,27 @@ namespace utils
 {
 	struct variant;
 
+	// File contents kept alive by owner, not NUL-terminated
+	struct ini_parser_view
+	{
+		const char* data{};
+		size_t size{};
+		std::shared_ptr<const void> owner;
+
+		bool empty() const { return size == 0; }
+	};
+
 	struct ini_parser_reader
 	{
 		virtual ~ini_parser_reader() = default;
 		virtual std::string read(const path& filename) const = 0;
+
+		// Override to share cached or mapped memory instead of copying
+		virtual ini_parser_view read_view(const path& filename) const
+		{
+			auto data = std::make_shared<const std::string>(read(filename));
+			return {data->data(), data->size(), data};
+		}
 	};
 
 	struct ini_parser_error_handler
@@ -28,6 +45,125 @@ namespace utils
 		virtual bool read_bool(const std::string& p, bool& ret) { return false; }
 	};
 
+	struct ini_parser_stats
+	{
+		enum phase
+		{
+			lexing,
+			substitution,
+			lua,
+			templates,
+			generators,
+			includes,
+			sequential,
+			phases_count
+		};
+
+		// Time is exclusive: Lua called during substitution only counts as Lua
+		struct counter
+		{
+			uint64_t calls;
+			uint64_t nanoseconds;
+			uint64_t bytes;
+		};
+
+		counter phases[phases_count]{};
+
+		uint64_t lua_chunk_hits{};
+		uint64_t lua_chunk_misses{};
+
+		// Expressions evaluated without running Lua
+		uint64_t lua_native{};
+
+		// Lua CPU time, peak Lua memory and calls stopped by limits
+		uint64_t lua_cpu_ns{};
+		uint64_t lua_memory_peak{};
+		uint64_t lua_limit_errors{};
+
+		void reset() { *this = {}; }
+		static const char* phase_name(int phase);
+	};
+
+	// Replays included files parsed before with the same parameters, thread-safe
+	struct ini_parser_include_cache
+	{
+		explicit ini_parser_include_cache(size_t max_variants_per_file = 16);
+		~ini_parser_include_cache();
+		ini_parser_include_cache(const ini_parser_include_cache&) = delete;
+		ini_parser_include_cache& operator=(const ini_parser_include_cache&) = delete;
+
+		void clear();
+		size_t hits() const;
+		size_t misses() const;
+
+	private:
+		friend struct ini_parser_data;
+		struct ini_parser_include_cache_data* data_;
+	};
+
+	// Reuses initialized Lua states between parsers, thread-safe, has to outlive them
+	struct ini_parser_lua_pool
+	{
+		explicit ini_parser_lua_pool(size_t max_idle = 16);
+		~ini_parser_lua_pool();
+		ini_parser_lua_pool(const ini_parser_lua_pool&) = delete;
+		ini_parser_lua_pool& operator=(const ini_parser_lua_pool&) = delete;
+
+		void clear();
+		size_t created() const;
+		size_t reused() const;
+
+	private:
+		friend struct ini_parser_lua_params;
+		struct ini_parser_lua_pool_data* data_;
+	};
+
+	// Remembers directory listings to find included files, relists a directory once it changes
+	struct ini_parser_path_cache
+	{
+		ini_parser_path_cache();
+		~ini_parser_path_cache();
+		ini_parser_path_cache(const ini_parser_path_cache&) = delete;
+		ini_parser_path_cache& operator=(const ini_parser_path_cache&) = delete;
+
+		void clear();
+		size_t hits() const;
+		size_t listed_directories() const;
+
+	private:
+		friend struct ini_parser_data;
+		struct ini_parser_path_cache_data* data_;
+	};
+
+	// Where sections and values came from, see ini_parser::record_provenance()
+	struct ini_parser_provenance
+	{
+		static constexpr uint32_t none = UINT32_MAX;
+
+		struct origin
+		{
+			uint32_t file = none;
+			uint32_t line{};
+			std::vector<uint32_t> included_from;
+			std::vector<std::string> templates;
+			std::vector<std::string> mixins;
+			std::string generator;
+			std::vector<std::string> variables;
+		};
+
+		struct section_entry
+		{
+			std::vector<uint32_t> origins;
+			robin_hood::unordered_flat_map<std::string, uint32_t> values;
+		};
+
+		std::vector<path> files;
+		std::vector<origin> origins;
+		robin_hood::unordered_flat_map<std::string, section_entry> sections;
+
+		std::string to_json(bool format = false) const;
+	};
+
 	struct ini_parser
 	{
 		using section = robin_hood::unordered_flat_map<std::string, variant>;
@@ -38,16 +174,33 @@ namespace utils
 		ini_parser& set_reader(ini_parser_reader* reader);
 		ini_parser& set_error_handler(ini_parser_error_handler* handler);
 		ini_parser& set_data_provider(ini_parser_data_provider* data_provider);
+		ini_parser& set_stats_sink(ini_parser_stats* stats);
+		ini_parser& set_include_cache(ini_parser_include_cache* cache);
+		ini_parser& set_lua_pool(ini_parser_lua_pool* pool);
+		ini_parser& set_path_cache(ini_parser_path_cache* cache);
+		// Allocates sections from an arena and reuses scopes, memory is kept until parser is destroyed
+		ini_parser& use_arena(bool value);
+		// Zero for no limit, memory limit is only enforced with Lua 5.3
+		ini_parser& set_lua_limits(uint64_t max_instructions, size_t max_memory);
 		ini_parser& allow_lua(bool value);
 		ini_parser& ignore_inactive(bool value);
+		// Reader has to be thread-safe
+		ini_parser& prefetch_includes(bool value);
+		ini_parser& record_provenance(bool value);
+		// Call before parsing to use reparse(), keeps inputs and sets own include cache if there is none
+		ini_parser& enable_reparse();
 		
 		const ini_parser& parse(const char* data, int data_size) const;
 		const ini_parser& parse(const std::string& data) const;
 		const ini_parser& parse_file(const path& path) const;
+		// Parses all inputs again, replaying unchanged includes from include cache; call finalize() afterwards
+		const ini_parser& reparse(const std::vector<path>& changed_files);
 		const ini_parser& finalize() const;
 		void finalize_end() const;
 
 		const robin_hood::unordered_flat_map<std::string, section>& get_sections() const;
+		// Only available after finalize() if recording was enabled, nullptr otherwise
+		const ini_parser_provenance* get_provenance() const;
 		
 		struct serializer_params
 		{
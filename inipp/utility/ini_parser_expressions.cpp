@@ -0,0 +1,906 @@
+﻿#include "stdafx.h"
+#include "ini_parser_expressions.h"
+
+namespace utils
+{
+	namespace
+	{
+		struct number
+		{
+			bool integer;
+			int64_t i;
+			double f;
+
+			static number from_int(int64_t v) { return {true, v, 0.}; }
+			static number from_float(double v) { return {false, 0, v}; }
+			double as_float() const { return integer ? double(i) : f; }
+		};
+
+		struct value
+		{
+			enum class kind : uint8_t
+			{
+				nil,
+				boolean,
+				number,
+				vector
+			};
+
+			kind type = kind::nil;
+			bool b{};
+			uint8_t size{};
+			std::array<number, 4> n{};
+
+			static value from_bool(bool v)
+			{
+				value ret;
+				ret.type = kind::boolean;
+				ret.b = v;
+				return ret;
+			}
+
+			static value from_number(const number& v)
+			{
+				value ret;
+				ret.type = kind::number;
+				ret.n[0] = v;
+				return ret;
+			}
+
+			bool truthy() const
+			{
+				return type != kind::nil && (type != kind::boolean || b);
+			}
+		};
+
+		enum class opcode : uint8_t
+		{
+			constant,
+			argument,
+			negate,
+			logical_not,
+			add,
+			subtract,
+			multiply,
+			divide,
+			floor_divide,
+			modulo,
+			power,
+			equal,
+			not_equal,
+			less,
+			less_equal,
+			greater,
+			greater_equal,
+			and_jump,
+			or_jump,
+			call,
+			component,
+		};
+
+		enum class function : uint8_t
+		{
+			vec2,
+			vec3,
+			vec4,
+			abs,
+			floor,
+			ceil,
+			sqrt,
+			sin,
+			cos,
+			tan,
+			asin,
+			acos,
+			atan,
+			exp,
+			log,
+			min,
+			max,
+			fmod,
+		};
+
+		// Same as isspace() in C locale, which Lua relies on
+		bool is_space(char c)
+		{
+			return c == ' ' || c >= '\t' && c <= '\r';
+		}
+
+		bool is_name_start(char c)
+		{
+			return isalpha(uint8_t(c)) || c == '_';
+		}
+
+		bool is_name_part(char c)
+		{
+			return isalnum(uint8_t(c)) || c == '_';
+		}
+
+		int hex_value(char c)
+		{
+			return isdigit(uint8_t(c)) ? c - '0' : (tolower(uint8_t(c)) - 'a') + 10;
+		}
+
+		// Replicas of l_str2int() and l_str2d() from lobject.c
+		bool str_to_int(const char* s, int64_t& result)
+		{
+			uint64_t a = 0;
+			auto empty = true;
+			while (is_space(*s)) s++;
+			auto neg = 0;
+			if (*s == '-')
+			{
+				s++;
+				neg = 1;
+			}
+			else if (*s == '+') s++;
+			if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+			{
+				for (s += 2; isxdigit(uint8_t(*s)); s++)
+				{
+					a = a * 16 + uint64_t(hex_value(*s));
+					empty = false;
+				}
+			}
+			else
+			{
+				const auto max_by_10 = uint64_t(INT64_MAX / 10);
+				const auto max_last_digit = int(INT64_MAX % 10);
+				for (; isdigit(uint8_t(*s)); s++)
+				{
+					const auto d = *s - '0';
+					if (a >= max_by_10 && (a > max_by_10 || d > max_last_digit + neg)) return false;
+					a = a * 10 + uint64_t(d);
+					empty = false;
+				}
+			}
+			while (is_space(*s)) s++;
+			if (empty || *s != '\0') return false;
+			result = int64_t(neg ? 0ULL - a : a);
+			return true;
+		}
+
+		bool str_to_float(const char* s, double& result)
+		{
+			const auto mode = strpbrk(s, ".xXnN");
+			if (mode && (*mode == 'n' || *mode == 'N')) return false;
+			char* end;
+			result = std::strtod(s, &end);
+			if (end == s) return false;
+			while (is_space(*end)) end++;
+			return *end == '\0';
+		}
+
+		bool str_to_number(const std::string& s, number& result)
+		{
+			if (s.find('\0') != std::string::npos) return false;
+			if (int64_t i; str_to_int(s.c_str(), i))
+			{
+				result = number::from_int(i);
+				return true;
+			}
+			if (double f; str_to_float(s.c_str(), f))
+			{
+				result = number::from_float(f);
+				return true;
+			}
+			return false;
+		}
+
+		// lua_Number2str() adds “.0” to floats looking like integers
+		std::string to_string(const number& n)
+		{
+			char buffer[64];
+			if (n.integer)
+			{
+				snprintf(buffer, sizeof buffer, "%lld", (long long)n.i);
+				return buffer;
+			}
+			std::string ret(buffer, size_t(snprintf(buffer, sizeof buffer, "%.14g", n.f)));
+			if (ret.find_first_not_of("-0123456789") == std::string::npos) ret += ".0";
+			return ret;
+		}
+
+		// Same as lua_numbertointeger()
+		bool float_to_int(double f, int64_t& result)
+		{
+			if (f >= double(INT64_MIN) && f < -double(INT64_MIN))
+			{
+				result = int64_t(f);
+				return true;
+			}
+			return false;
+		}
+
+		// Integers up to 2⁵³ convert to floats exactly, others are rare enough to be left for Lua
+		bool fits_float(int64_t i)
+		{
+			return uint64_t(i) + (1ULL << 53) <= (1ULL << 54);
+		}
+
+		bool less_than(const number& l, const number& r, bool or_equal, bool& result)
+		{
+			if (l.integer && r.integer)
+			{
+				result = or_equal ? l.i <= r.i : l.i < r.i;
+				return true;
+			}
+			if (l.integer && !fits_float(l.i) || r.integer && !fits_float(r.i)) return false;
+			result = or_equal ? l.as_float() <= r.as_float() : l.as_float() < r.as_float();
+			return true;
+		}
+
+		bool equals(const number& l, const number& r)
+		{
+			if (l.integer == r.integer) return l.integer ? l.i == r.i : l.f == r.f;
+			const auto& i = l.integer ? l : r;
+			const auto& f = l.integer ? r : l;
+			int64_t converted;
+			return std::floor(f.f) == f.f && float_to_int(f.f, converted) && converted == i.i;
+		}
+
+		bool arithmetic(opcode op, const number& l, const number& r, number& result)
+		{
+			if (op == opcode::divide || op == opcode::power || !l.integer || !r.integer)
+			{
+				const auto a = l.as_float();
+				const auto b = r.as_float();
+				switch (op)
+				{
+					case opcode::add: result = number::from_float(a + b);
+						return true;
+					case opcode::subtract: result = number::from_float(a - b);
+						return true;
+					case opcode::multiply: result = number::from_float(a * b);
+						return true;
+					case opcode::divide: result = number::from_float(a / b);
+						return true;
+					case opcode::power: result = number::from_float(std::pow(a, b));
+						return true;
+					case opcode::floor_divide: result = number::from_float(std::floor(a / b));
+						return true;
+					case opcode::modulo:
+					{
+						auto m = std::fmod(a, b);
+						if (m * b < 0) m += b;
+						result = number::from_float(m);
+						return true;
+					}
+					default: return false;
+				}
+			}
+
+			const auto a = uint64_t(l.i);
+			const auto b = uint64_t(r.i);
+			switch (op)
+			{
+				case opcode::add: result = number::from_int(int64_t(a + b));
+					return true;
+				case opcode::subtract: result = number::from_int(int64_t(a - b));
+					return true;
+				case opcode::multiply: result = number::from_int(int64_t(a * b));
+					return true;
+				case opcode::floor_divide:
+				{
+					// Division by zero is an error in Lua
+					if (r.i == 0) return false;
+					if (r.i == -1)
+					{
+						result = number::from_int(int64_t(0ULL - a));
+						return true;
+					}
+					auto q = l.i / r.i;
+					if ((l.i ^ r.i) < 0 && l.i % r.i != 0) q -= 1;
+					result = number::from_int(q);
+					return true;
+				}
+				case opcode::modulo:
+				{
+					if (r.i == 0) return false;
+					if (r.i == -1)
+					{
+						result = number::from_int(0);
+						return true;
+					}
+					auto m = l.i % r.i;
+					if (m != 0 && (m ^ r.i) < 0) m += r.i;
+					result = number::from_int(m);
+					return true;
+				}
+				default: return false;
+			}
+		}
+
+		// Vectors follow metamethods of standard library: operation is done per component, vector on the left
+		// decides the size, missing components of vector on the right are zeroes
+		bool arithmetic(opcode op, const value& l, const value& r, value& result)
+		{
+			using kind = value::kind;
+			if (l.type == kind::number && r.type == kind::number)
+			{
+				result.type = kind::number;
+				return arithmetic(op, l.n[0], r.n[0], result.n[0]);
+			}
+
+			if (op == opcode::floor_divide) return false;
+			if (l.type == kind::vector && r.type == kind::number)
+			{
+				result.type = kind::vector;
+				result.size = l.size;
+				for (auto i = 0; i < l.size; i++)
+				{
+					if (!arithmetic(op, l.n[i], r.n[0], result.n[i])) return false;
+				}
+				return true;
+			}
+
+			if (l.type == kind::number && r.type == kind::vector)
+			{
+				result.type = kind::vector;
+				result.size = r.size;
+				for (auto i = 0; i < r.size; i++)
+				{
+					if (!arithmetic(op, l.n[0], r.n[i], result.n[i])) return false;
+				}
+				return true;
+			}
+
+			if (l.type == kind::vector && r.type == kind::vector)
+			{
+				result.type = kind::vector;
+				result.size = l.size;
+				for (auto i = 0; i < l.size; i++)
+				{
+					if (!arithmetic(op, l.n[i], i < r.size ? r.n[i] : number::from_int(0), result.n[i])) return false;
+				}
+				return true;
+			}
+			return false;
+		}
+
+		bool compare(opcode op, const value& l, const value& r, value& result)
+		{
+			using kind = value::kind;
+			if (op == opcode::equal || op == opcode::not_equal)
+			{
+				bool same;
+				if (l.type != r.type) same = false;
+				else if (l.type == kind::nil) same = true;
+				else if (l.type == kind::boolean) same = l.b == r.b;
+				else if (l.type == kind::number) same = equals(l.n[0], r.n[0]);
+				else return false;
+				result = value::from_bool(same == (op == opcode::equal));
+				return true;
+			}
+
+			if (l.type != kind::number || r.type != kind::number) return false;
+			bool ret;
+			switch (op)
+			{
+				case opcode::less: if (!less_than(l.n[0], r.n[0], false, ret)) return false;
+					break;
+				case opcode::less_equal: if (!less_than(l.n[0], r.n[0], true, ret)) return false;
+					break;
+				case opcode::greater: if (!less_than(r.n[0], l.n[0], false, ret)) return false;
+					break;
+				case opcode::greater_equal: if (!less_than(r.n[0], l.n[0], true, ret)) return false;
+					break;
+				default: return false;
+			}
+			result = value::from_bool(ret);
+			return true;
+		}
+
+		bool check_number(const value* args, int count, int index, double& result)
+		{
+			if (index >= count || args[index].type != value::kind::number) return false;
+			result = args[index].n[0].as_float();
+			return true;
+		}
+
+		bool call(function fn, const value* args, int count, value& result)
+		{
+			using kind = value::kind;
+			if (fn <= function::vec4)
+			{
+				const auto size = int(fn) - int(function::vec2) + 2;
+				result.type = kind::vector;
+				result.size = 0;
+				for (auto i = 0; i < std::min(count, size); i++)
+				{
+					const auto& a = args[i];
+					if (a.type == kind::nil) continue;
+					const auto added = a.type == kind::vector ? a.size : 1;
+					if (a.type != kind::number && a.type != kind::vector || result.size + added > size) return false;
+					for (auto j = 0; j < added; j++)
+					{
+						result.n[result.size++] = a.n[j];
+					}
+				}
+				return result.size == size;
+			}
+
+			double x;
+			switch (fn)
+			{
+				case function::abs:
+				{
+					if (count < 1 || args[0].type != kind::number) return false;
+					const auto& n = args[0].n[0];
+					result = value::from_number(n.integer
+						? number::from_int(n.i < 0 ? int64_t(0ULL - uint64_t(n.i)) : n.i)
+						: number::from_float(std::fabs(n.f)));
+					return true;
+				}
+				case function::floor:
+				case function::ceil:
+				{
+					if (count < 1 || args[0].type != kind::number) return false;
+					if (args[0].n[0].integer)
+					{
+						result = args[0];
+						return true;
+					}
+					const auto f = fn == function::floor ? std::floor(args[0].n[0].f) : std::ceil(args[0].n[0].f);
+					int64_t i;
+					result = value::from_number(float_to_int(f, i) ? number::from_int(i) : number::from_float(f));
+					return true;
+				}
+				case function::sqrt: if (!check_number(args, count, 0, x)) return false;
+					result = value::from_number(number::from_float(std::sqrt(x)));
+					return true;
+				case function::sin: if (!check_number(args, count, 0, x)) return false;
+					result = value::from_number(number::from_float(std::sin(x)));
+					return true;
+				case function::cos: if (!check_number(args, count, 0, x)) return false;
+					result = value::from_number(number::from_float(std::cos(x)));
+					return true;
+				case function::tan: if (!check_number(args, count, 0, x)) return false;
+					result = value::from_number(number::from_float(std::tan(x)));
+					return true;
+				case function::asin: if (!check_number(args, count, 0, x)) return false;
+					result = value::from_number(number::from_float(std::asin(x)));
+					return true;
+				case function::acos: if (!check_number(args, count, 0, x)) return false;
+					result = value::from_number(number::from_float(std::acos(x)));
+					return true;
+				case function::exp: if (!check_number(args, count, 0, x)) return false;
+					result = value::from_number(number::from_float(std::exp(x)));
+					return true;
+				case function::atan:
+				{
+					auto y = 1.;
+					if (!check_number(args, count, 0, x)) return false;
+					if (count > 1 && args[1].type != kind::nil && !check_number(args, count, 1, y)) return false;
+					result = value::from_number(number::from_float(std::atan2(x, y)));
+					return true;
+				}
+				case function::log:
+				{
+					if (!check_number(args, count, 0, x)) return false;
+					if (count < 2 || args[1].type == kind::nil)
+					{
+						result = value::from_number(number::from_float(std::log(x)));
+						return true;
+					}
+					double base;
+					if (!check_number(args, count, 1, base)) return false;
+					result = value::from_number(number::from_float(base == 2. ? std::log2(x) : base == 10. ? std::log10(x) : std::log(x) / std::log(base)));
+					return true;
+				}
+				case function::min:
+				case function::max:
+				{
+					if (count < 1) return false;
+					auto best = 0;
+					for (auto i = 0; i < count; i++)
+					{
+						if (args[i].type != kind::number) return false;
+						bool better;
+						if (i > 0 && !(fn == function::min
+							? less_than(args[i].n[0], args[best].n[0], false, better)
+							: less_than(args[best].n[0], args[i].n[0], false, better))) return false;
+						if (i > 0 && better) best = i;
+					}
+					result = args[best];
+					return true;
+				}
+				case function::fmod:
+				{
+					if (count < 2 || args[0].type != kind::number || args[1].type != kind::number) return false;
+					const auto& a = args[0].n[0];
+					const auto& b = args[1].n[0];
+					if (a.integer && b.integer)
+					{
+						if (b.i == 0) return false;
+						result = value::from_number(number::from_int(b.i == -1 ? 0 : a.i % b.i));
+						return true;
+					}
+					result = value::from_number(number::from_float(std::fmod(a.as_float(), b.as_float())));
+					return true;
+				}
+				default: return false;
+			}
+		}
+
+		void add_results(const value& v, std::vector<std::string>& results)
+		{
+			switch (v.type)
+			{
+				case value::kind::nil: results.emplace_back();
+					break;
+				case value::kind::boolean: results.emplace_back(v.b ? "1" : "0");
+					break;
+				case value::kind::number: results.push_back(to_string(v.n[0]));
+					break;
+				case value::kind::vector:
+				{
+					for (auto i = 0; i < v.size; i++)
+					{
+						results.push_back(to_string(v.n[i]));
+					}
+					break;
+				}
+			}
+		}
+	}
+
+	struct ini_parser_expression::instruction
+	{
+		opcode op;
+		uint8_t index;
+		uint16_t target;
+		value constant;
+	};
+
+	namespace
+	{
+		constexpr auto max_stack = 32;
+
+		// Recursive descent parser with the same priorities as Lua’s subexpr()
+		struct expression_parser
+		{
+			using instruction = ini_parser_expression::instruction;
+
+			const char* p;
+			const char* end;
+			std::vector<instruction>& out;
+			int depth{};
+			int max_depth{};
+
+			void skip_spaces()
+			{
+				while (p < end && is_space(*p)) ++p;
+			}
+
+			bool peek(const char* token, size_t size)
+			{
+				skip_spaces();
+				if (size_t(end - p) < size || memcmp(p, token, size) != 0) return false;
+				return !is_name_start(*token) || p + size == end || !is_name_part(p[size]);
+			}
+
+			bool accept(const char* token)
+			{
+				const auto size = strlen(token);
+				if (!peek(token, size)) return false;
+				p += size;
+				return true;
+			}
+
+			std::string_view name()
+			{
+				skip_spaces();
+				if (p == end || !is_name_start(*p)) return {};
+				const auto start = p;
+				while (p < end && is_name_part(*p)) ++p;
+				return {start, size_t(p - start)};
+			}
+
+			void emit(opcode op, int stack_change, uint8_t index = 0, const value& constant = {})
+			{
+				out.push_back({op, index, 0, constant});
+				depth += stack_change;
+				max_depth = std::max(max_depth, depth);
+			}
+
+			struct binary_operator
+			{
+				const char* token;
+				size_t size;
+				opcode op;
+				int left;
+				int right;
+			};
+
+			// Binary operators with left and right priorities, as in lparser.c; shifts, concatenation and bitwise
+			// operators are not supported, and neither are comments
+			const binary_operator* next_operator()
+			{
+				static constexpr binary_operator operators[] = {
+					{"or", 2, opcode::or_jump, 1, 1},
+					{"and", 3, opcode::and_jump, 2, 2},
+					{"<=", 2, opcode::less_equal, 3, 3},
+					{">=", 2, opcode::greater_equal, 3, 3},
+					{"==", 2, opcode::equal, 3, 3},
+					{"~=", 2, opcode::not_equal, 3, 3},
+					{"<<", 2, opcode::constant, 0, 0},
+					{">>", 2, opcode::constant, 0, 0},
+					{"<", 1, opcode::less, 3, 3},
+					{">", 1, opcode::greater, 3, 3},
+					{"+", 1, opcode::add, 10, 10},
+					{"--", 2, opcode::constant, 0, 0},
+					{"-", 1, opcode::subtract, 10, 10},
+					{"*", 1, opcode::multiply, 11, 11},
+					{"//", 2, opcode::floor_divide, 11, 11},
+					{"/", 1, opcode::divide, 11, 11},
+					{"%", 1, opcode::modulo, 11, 11},
+					{"^", 1, opcode::power, 14, 13},
+				};
+				for (const auto& o : operators)
+				{
+					if (peek(o.token, o.size)) return o.op == opcode::constant ? nullptr : &o;
+				}
+				return nullptr;
+			}
+
+			bool numeral()
+			{
+				// Same characters as read_numeral() in llex.c takes
+				const auto start = p;
+				const char* exponent = "Ee";
+				if (p + 1 < end && p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+				{
+					exponent = "Pp";
+					p += 2;
+				}
+				while (p < end)
+				{
+					if (*p == exponent[0] || *p == exponent[1])
+					{
+						++p;
+						if (p < end && (*p == '-' || *p == '+')) ++p;
+					}
+					else if (isxdigit(uint8_t(*p)) || *p == '.') ++p;
+					else break;
+				}
+				number n;
+				if (!str_to_number(std::string(start, p), n)) return false;
+				emit(opcode::constant, 1, 0, value::from_number(n));
+				return true;
+			}
+
+			bool arguments(int& count)
+			{
+				count = 0;
+				if (!accept("(")) return false;
+				if (accept(")")) return true;
+				do
+				{
+					if (!expression(0)) return false;
+					++count;
+				} while (accept(","));
+				return count < 256 && accept(")");
+			}
+
+			bool call(function fn)
+			{
+				int count;
+				if (!arguments(count)) return false;
+				emit(opcode::call, 1 - count, uint8_t(fn), value::from_number(number::from_int(count)));
+				return true;
+			}
+
+			bool primary()
+			{
+				skip_spaces();
+				if (p == end) return false;
+				if (isdigit(uint8_t(*p)) || *p == '.' && p + 1 < end && isdigit(uint8_t(p[1]))) return numeral();
+				if (accept("("))
+				{
+					return expression(0) && accept(")");
+				}
+
+				const auto n = name();
+				if (n == "nil") emit(opcode::constant, 1);
+				else if (n == "true" || n == "false") emit(opcode::constant, 1, 0, value::from_bool(n == "true"));
+				else if (n.starts_with("__arg") && n.size() > 5 && std::ranges::all_of(n.substr(5), [](char c) { return isdigit(uint8_t(c)) != 0; }))
+				{
+					const auto index = std::strtoul(std::string(n.substr(5)).c_str(), nullptr, 10);
+					if (index < 1 || index > 255) return false;
+					emit(opcode::argument, 1, uint8_t(index - 1));
+				}
+				else if (n == "vec2") return call(function::vec2);
+				else if (n == "vec3") return call(function::vec3);
+				else if (n == "vec4") return call(function::vec4);
+				else if (n == "math" && accept("."))
+				{
+					const auto m = name();
+					if (m == "pi") emit(opcode::constant, 1, 0, value::from_number(number::from_float(3.141592653589793238462643383279502884)));
+					else if (m == "huge") emit(opcode::constant, 1, 0, value::from_number(number::from_float(HUGE_VAL)));
+					else if (m == "maxinteger") emit(opcode::constant, 1, 0, value::from_number(number::from_int(INT64_MAX)));
+					else if (m == "mininteger") emit(opcode::constant, 1, 0, value::from_number(number::from_int(INT64_MIN)));
+					else if (m == "abs") return call(function::abs);
+					else if (m == "floor") return call(function::floor);
+					else if (m == "ceil") return call(function::ceil);
+					else if (m == "sqrt") return call(function::sqrt);
+					else if (m == "sin") return call(function::sin);
+					else if (m == "cos") return call(function::cos);
+					else if (m == "tan") return call(function::tan);
+					else if (m == "asin") return call(function::asin);
+					else if (m == "acos") return call(function::acos);
+					else if (m == "atan") return call(function::atan);
+					else if (m == "exp") return call(function::exp);
+					else if (m == "log") return call(function::log);
+					else if (m == "min") return call(function::min);
+					else if (m == "max") return call(function::max);
+					else if (m == "fmod") return call(function::fmod);
+					else return false;
+				}
+				else return false;
+				return true;
+			}
+
+			bool suffixed()
+			{
+				if (!primary()) return false;
+				for (;;)
+				{
+					skip_spaces();
+					if (p + 1 < end && p[0] == '.' && p[1] != '.')
+					{
+						++p;
+						const auto n = name();
+						if (n.size() != 1) return false;
+						const auto c = char(tolower(uint8_t(n[0])));
+						if (c < 'w' || c > 'z') return false;
+						emit(opcode::component, 0, uint8_t(c == 'w' ? 3 : c - 'x'));
+					}
+					else if (p < end && (*p == ':' || *p == '[' || *p == '(' || *p == '{' || *p == '"' || *p == '\'')) return false;
+					else return true;
+				}
+			}
+
+			bool expression(int limit)
+			{
+				if (peek("--", 2)) return false;
+				if (accept("not") || accept("-"))
+				{
+					const auto op = p[-1] == '-' ? opcode::negate : opcode::logical_not;
+					if (!expression(12)) return false;
+					emit(op, 0);
+				}
+				else if (!suffixed()) return false;
+
+				for (auto o = next_operator(); o && o->left > limit; o = next_operator())
+				{
+					p += o->size;
+					if (o->op == opcode::and_jump || o->op == opcode::or_jump)
+					{
+						const auto jump = out.size();
+						emit(o->op, -1);
+						if (!expression(o->right)) return false;
+						out[jump].target = uint16_t(out.size());
+					}
+					else
+					{
+						if (!expression(o->right)) return false;
+						emit(o->op, -1);
+					}
+				}
+				return true;
+			}
+		};
+	}
+
+	ini_parser_expression::ini_parser_expression() = default;
+	ini_parser_expression::~ini_parser_expression() = default;
+
+	std::unique_ptr<ini_parser_expression> ini_parser_expression::compile(const std::string& expr)
+	{
+		std::unique_ptr<ini_parser_expression> ret(new ini_parser_expression());
+		expression_parser parser{expr.data(), expr.data() + expr.size(), ret->program_};
+		if (!parser.expression(0)) return nullptr;
+		parser.skip_spaces();
+		if (parser.p != parser.end || parser.max_depth > max_stack || ret->program_.size() > UINT16_MAX) return nullptr;
+		return ret;
+	}
+
+	std::string ini_parser_expression::format_number(int64_t value)
+	{
+		return to_string(number::from_int(value));
+	}
+
+	std::string ini_parser_expression::format_number(double value)
+	{
+		return to_string(number::from_float(value));
+	}
+
+	bool ini_parser_expression::evaluate(const std::vector<const std::string*>& arguments, std::vector<std::string>& results) const
+	{
+		std::array<value, max_stack> stack;
+		auto top = 0;
+		for (size_t i = 0, n = program_.size(); i < n; i++)
+		{
+			const auto& c = program_[i];
+			switch (c.op)
+			{
+				case opcode::constant: stack[top++] = c.constant;
+					break;
+				case opcode::argument:
+				{
+					number v;
+					if (c.index >= arguments.size() || !str_to_number(*arguments[c.index], v)) return false;
+					stack[top++] = value::from_number(v);
+					break;
+				}
+				case opcode::negate:
+				{
+					auto& v = stack[top - 1];
+					if (v.type != value::kind::number && v.type != value::kind::vector) return false;
+					for (auto j = 0, s = v.type == value::kind::vector ? int(v.size) : 1; j < s; j++)
+					{
+						auto& x = v.n[j];
+						if (x.integer) x.i = int64_t(0ULL - uint64_t(x.i));
+						else x.f = -x.f;
+					}
+					break;
+				}
+				case opcode::logical_not: stack[top - 1] = value::from_bool(!stack[top - 1].truthy());
+					break;
+				case opcode::add:
+				case opcode::subtract:
+				case opcode::multiply:
+				case opcode::divide:
+				case opcode::floor_divide:
+				case opcode::modulo:
+				case opcode::power:
+				{
+					value r;
+					if (!arithmetic(c.op, stack[top - 2], stack[top - 1], r)) return false;
+					stack[--top - 1] = r;
+					break;
+				}
+				case opcode::equal:
+				case opcode::not_equal:
+				case opcode::less:
+				case opcode::less_equal:
+				case opcode::greater:
+				case opcode::greater_equal:
+				{
+					value r;
+					if (!compare(c.op, stack[top - 2], stack[top - 1], r)) return false;
+					stack[--top - 1] = r;
+					break;
+				}
+				case opcode::and_jump:
+				case opcode::or_jump:
+				{
+					// Either left operand is the result, or it’s dropped and right one is calculated
+					if (stack[top - 1].truthy() == (c.op == opcode::or_jump)) i = size_t(c.target) - 1;
+					else --top;
+					break;
+				}
+				case opcode::call:
+				{
+					const auto count = int(c.constant.n[0].i);
+					value r;
+					if (!call(function(c.index), &stack[top - count], count, r)) return false;
+					top -= count;
+					stack[top++] = r;
+					break;
+				}
+				case opcode::component:
+				{
+					auto& v = stack[top - 1];
+					if (v.type != value::kind::vector) return false;
+					v = c.index < v.size ? value::from_number(v.n[c.index]) : value{};
+					break;
+				}
+			}
+		}
+		if (top != 1) return false;
+		add_results(stack[0], results);
+		return true;
+	}
+}
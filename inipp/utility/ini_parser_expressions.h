@@ -0,0 +1,36 @@
+﻿#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace utils
+{
+	// Evaluator for plain arithmetic expressions, so most of them would not need Lua at all. Follows Lua 5.3 rules to
+	// the bit: integer and float subtypes, wrapping integer arithmetic, floor division and modulo, number formatting,
+	// vec2/vec3/vec4 from standard INIpp library. Supports numbers, nil and booleans, arithmetic, comparisons,
+	// and/or/not, vector components and common math functions. Expressions using anything else are not compiled,
+	// and expressions which would raise an error in Lua fail to evaluate, leaving it for Lua to report.
+	struct ini_parser_expression
+	{
+		// Returns nullptr if expression uses something evaluator does not support
+		static std::unique_ptr<ini_parser_expression> compile(const std::string& expr);
+
+		// Arguments __arg1…__argN are numbers in text form. Results are converted to strings the way __conv_result()
+		// and lua_tolstring() would.
+		bool evaluate(const std::vector<const std::string*>& arguments, std::vector<std::string>& results) const;
+
+		// Formats numbers exactly like lua_tolstring() does, without making Lua strings
+		static std::string format_number(int64_t value);
+		static std::string format_number(double value);
+
+		ini_parser_expression(const ini_parser_expression& other) = delete;
+		ini_parser_expression& operator=(const ini_parser_expression& other) = delete;
+		~ini_parser_expression();
+
+		struct instruction;
+
+	private:
+		std::vector<instruction> program_;
+		ini_parser_expression();
+	};
+}
@@ -45,4 +45,9 @@ lerp=math.lerp
 lerpInvSat=math.lerpInvSat
 smoothstep=math.smoothstep
 smootherstep=math.smootherstep)"";
+
+	const unsigned char LUA_STD_BYTECODE[] = {
+		0
+	};
+	const size_t LUA_STD_BYTECODE_SIZE = 0;
 }
\ No newline at end of file
@@ -0,0 +1,173 @@
+﻿#include "stdafx.h"
+#include "ini_parser_readers.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace utils
+{
+	static std::shared_ptr<const std::string> read_file(const std::filesystem::path& filename)
+	{
+		std::stringstream buffer;
+		buffer << std::ifstream(filename).rdbuf();
+		return std::make_shared<const std::string>(buffer.str());
+	}
+
+	ini_parser_caching_reader::ini_parser_caching_reader(size_t memory_budget)
+		: memory_budget_(memory_budget) { }
+
+	std::string ini_parser_caching_reader::read(const path& filename) const
+	{
+		const auto data = get(filename);
+		return data ? *data : std::string();
+	}
+
+	ini_parser_view ini_parser_caching_reader::read_view(const path& filename) const
+	{
+		auto data = get(filename);
+		if (!data) return {};
+		return {data->data(), data->size(), std::move(data)};
+	}
+
+	std::shared_ptr<const std::string> ini_parser_caching_reader::get(const path& filename) const
+	{
+		std::error_code ec;
+		const auto original = std::filesystem::path(filename.wstring());
+		auto canonical = std::filesystem::weakly_canonical(original, ec);
+		if (ec) canonical = original;
+
+		const auto write_time = std::filesystem::last_write_time(canonical, ec);
+		const auto size = ec ? 0 : std::filesystem::file_size(canonical, ec);
+		const auto& key = canonical.native();
+		if (ec)
+		{
+			std::lock_guard lock(mutex_);
+			if (const auto found = entries_.find(key); found != entries_.end())
+			{
+				memory_usage_ -= found->second.data->size();
+				entries_.erase(found);
+			}
+			return nullptr;
+		}
+
+		{
+			std::lock_guard lock(mutex_);
+			if (const auto found = entries_.find(key); found != entries_.end())
+			{
+				if (found->second.write_time == write_time && found->second.size == size)
+				{
+					++hits_;
+					found->second.last_used = ++tick_;
+					return found->second.data;
+				}
+				memory_usage_ -= found->second.data->size();
+				entries_.erase(found);
+			}
+		}
+
+		// Reading without holding the lock, so other threads could get their cached files meanwhile
+		++misses_;
+		auto data = read_file(canonical);
+		if (data->size() <= memory_budget_)
+		{
+			std::lock_guard lock(mutex_);
+			if (const auto found = entries_.find(key); found != entries_.end())
+			{
+				memory_usage_ -= found->second.data->size();
+				entries_.erase(found);
+			}
+			evict(data->size());
+			entries_[key] = {data, write_time, size, ++tick_};
+			memory_usage_ += data->size();
+		}
+		return data;
+	}
+
+	void ini_parser_caching_reader::evict(size_t required) const
+	{
+		while (!entries_.empty() && memory_usage_ + required > memory_budget_)
+		{
+			auto oldest = entries_.begin();
+			for (auto i = entries_.begin(); i != entries_.end(); ++i)
+			{
+				if (i->second.last_used < oldest->second.last_used) oldest = i;
+			}
+			memory_usage_ -= oldest->second.data->size();
+			entries_.erase(oldest);
+		}
+	}
+
+	void ini_parser_caching_reader::clear()
+	{
+		std::lock_guard lock(mutex_);
+		entries_.clear();
+		memory_usage_ = 0;
+	}
+
+	size_t ini_parser_caching_reader::memory_usage() const
+	{
+		std::lock_guard lock(mutex_);
+		return memory_usage_;
+	}
+
+	std::string ini_parser_mapped_reader::read(const path& filename) const
+	{
+		const auto view = read_view(filename);
+		return view.empty() ? std::string() : std::string(view.data, view.size);
+	}
+
+	#ifdef _WIN32
+
+	ini_parser_view ini_parser_mapped_reader::read_view(const path& filename) const
+	{
+		const auto file = CreateFileW(filename.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return {};
+
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+		{
+			CloseHandle(file);
+			return {};
+		}
+
+		const auto mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		CloseHandle(file);
+		if (!mapping) return {};
+
+		const auto data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+		if (!data) return {};
+
+		return {(const char*)data, size_t(size.QuadPart), std::shared_ptr<const void>(data, [](const void* p) { UnmapViewOfFile(p); })};
+	}
+
+	#else
+
+	ini_parser_view ini_parser_mapped_reader::read_view(const path& filename) const
+	{
+		const auto fd = open(filename.string().c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd == -1) return {};
+
+		struct stat st{};
+		if (fstat(fd, &st) != 0 || st.st_size <= 0)
+		{
+			close(fd);
+			return {};
+		}
+
+		const auto size = size_t(st.st_size);
+		const auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (data == MAP_FAILED) return {};
+
+		madvise(data, size, MADV_SEQUENTIAL);
+		return {(const char*)data, size, std::shared_ptr<const void>(data, [size](const void* p) { munmap(const_cast<void*>(p), size); })};
+	}
+
+	#endif
+}
@@ -0,0 +1,53 @@
+﻿#pragma once
+#include <utility/ini_parser.h>
+#include <mutex>
+
+namespace utils
+{
+	// Reader keeping contents of recently read files in memory. Entries are keyed by canonical path and
+	// validated by modification time and size, so changed files are read again. Safe to share between
+	// threads and parsers.
+	struct ini_parser_caching_reader : ini_parser_reader
+	{
+		explicit ini_parser_caching_reader(size_t memory_budget = 64ULL << 20);
+
+		std::string read(const path& filename) const override;
+		ini_parser_view read_view(const path& filename) const override;
+		void clear();
+
+		size_t memory_usage() const;
+		uint64_t hits() const { return hits_; }
+		uint64_t misses() const { return misses_; }
+
+	private:
+		struct entry
+		{
+			std::shared_ptr<const std::string> data;
+			std::filesystem::file_time_type write_time;
+			uintmax_t size;
+			uint64_t last_used;
+		};
+
+		std::shared_ptr<const std::string> get(const path& filename) const;
+		void evict(size_t required) const;
+
+		size_t memory_budget_;
+		mutable std::mutex mutex_;
+		mutable robin_hood::unordered_node_map<std::filesystem::path::string_type, entry> entries_;
+		mutable size_t memory_usage_{};
+		mutable uint64_t tick_{};
+		mutable std::atomic<uint64_t> hits_{};
+		mutable std::atomic<uint64_t> misses_{};
+	};
+
+	// Reader mapping files into memory instead of copying them: parser works with pages straight from
+	// system cache, so peak memory stays low and processes parsing the same includes share those pages.
+	// Note: unlike stream-based readers, line endings are left as they are. Views end exactly where file ends, with
+	// no terminating byte after them. On POSIX, a file truncated while its view is still in use raises SIGBUS once
+	// parser gets to pages which are no longer there.
+	struct ini_parser_mapped_reader : ini_parser_reader
+	{
+		std::string read(const path& filename) const override;
+		ini_parser_view read_view(const path& filename) const override;
+	};
+}
@@ -13529,7 +13529,8 @@ class basic_json
     }
 
 	// CSP: custom safe conversions
-	template <typename T> struct converter
+	// Extra parameter keeps specializations partial, so they are allowed within class scope
+	template <typename T, typename = void> struct converter
 	{
 		static T as(const basic_json& that, T fallback_value = {}) noexcept
 		{
@@ -13537,7 +13538,7 @@ class basic_json
 		}
 	};
 
-	template <> struct converter<math::float3>
+	template <typename Void> struct converter<math::float3, Void>
 	{
 		static math::float3 str_to_f3(std::string r)
 		{
@@ -13556,7 +13557,7 @@ class basic_json
 		}
 	};
 
-	template <> struct converter<std::string>
+	template <typename Void> struct converter<std::string, Void>
 	{
 		static std::string as(const basic_json& that, std::string fallback_value = {}) noexcept
 		{
@@ -13567,7 +13568,7 @@ class basic_json
 		}
 	};
 
-	template <> struct converter<std::wstring>
+	template <typename Void> struct converter<std::wstring, Void>
 	{
 		static std::wstring as(const basic_json& that, std::wstring fallback_value = {}) noexcept
 		{
@@ -13578,7 +13579,7 @@ class basic_json
 		}
 	};
 
-	template <> struct converter<bool>
+	template <typename Void> struct converter<bool, Void>
 	{
 		static bool as(const basic_json& that, bool fallback_value = {}) noexcept
 		{
@@ -13590,7 +13591,7 @@ class basic_json
 		}
 	};
 
-	template <> struct converter<float>
+	template <typename Void> struct converter<float, Void>
 	{
 		static float as(const basic_json& that, float fallback_value = {}) noexcept
 		{
@@ -13602,7 +13603,7 @@ class basic_json
 		}
 	};
 
-	template <> struct converter<int32_t>
+	template <typename Void> struct converter<int32_t, Void>
 	{
 		static int as(const basic_json& that, int fallback_value = {}) noexcept
 		{
@@ -13614,7 +13615,7 @@ class basic_json
 		}
 	};
 
-	template <> struct converter<uint32_t>
+	template <typename Void> struct converter<uint32_t, Void>
 	{
 		static uint32_t as(const basic_json& that, uint32_t fallback_value = {}) noexcept
 		{
@@ -13624,7 +13625,7 @@ class basic_json
 		}
 	};
 
-	template <> struct converter<int64_t>
+	template <typename Void> struct converter<int64_t, Void>
 	{
 		static int64_t as(const basic_json& that, int64_t fallback_value = {}) noexcept
 		{
@@ -13636,7 +13637,7 @@ class basic_json
 		}
 	};
 
-	template <> struct converter<uint64_t>
+	template <typename Void> struct converter<uint64_t, Void>
 	{
 		static uint64_t as(const basic_json& that, uint64_t fallback_value = {}) noexcept
 		{
@@ -13646,7 +13647,7 @@ class basic_json
 		}
 	};
 
-	template <typename T> struct converter<std::vector<T>>
+	template <typename T, typename Void> struct converter<std::vector<T>, Void>
 	{
 		static std::vector<T> as(const basic_json& that, std::vector<T> fallback_value = {}) noexcept
 		{
@@ -13664,15 +13665,14 @@ class basic_json
 	};
 
 	template<typename T>
-	static T fit_key(const std::string& s) = delete;
-
-	template<>
-	static std::string fit_key<>(const std::string& s) { return s; }
-
-	template<>
-	static std::wstring fit_key<>(const std::string& s) { return utils::utf16(s); }
+	static T fit_key(const std::string& s)
+	{
+		static_assert(std::is_same_v<T, std::string> || std::is_same_v<T, std::wstring>);
+		if constexpr (std::is_same_v<T, std::wstring>) return utils::utf16(s);
+		else return s;
+	}
 
-	template <typename TKey, typename TValue> struct converter<std::unordered_map<TKey, TValue>>
+	template <typename TKey, typename TValue, typename Void> struct converter<std::unordered_map<TKey, TValue>, Void>
 	{
 		static std::unordered_map<TKey, TValue> as(const basic_json& that, std::unordered_map<TKey, TValue> fallback_value = {}) noexcept
 		{
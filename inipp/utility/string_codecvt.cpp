@@ -5,6 +5,53 @@
 
 namespace utils
 {
+	#ifndef _WIN32
+	// UTF-8 ↔ UTF-32 counterparts of WinAPI functions for CP_UTF8: with zero out_size return required size,
+	// return 0 if output doesn’t fit
+	enum { CP_UTF8 = 65001 };
+
+	static int MultiByteToWideChar(int, int, const char* s, int len, wchar_t* out, int out_size)
+	{
+		auto r = 0;
+		for (auto i = 0; i < len; ++r)
+		{
+			const auto c = uint8_t(s[i]);
+			const auto extra = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : 0;
+			auto v = uint32_t(extra == 0 ? c : c & (0x3f >> extra));
+			for (auto j = 1; j <= extra && i + j < len; ++j)
+			{
+				v = v << 6 | (uint8_t(s[i + j]) & 0x3f);
+			}
+			i += extra + 1;
+			if (out_size == 0) continue;
+			if (r >= out_size) return 0;
+			out[r] = wchar_t(v);
+		}
+		return r;
+	}
+
+	static int WideCharToMultiByte(int, int, const wchar_t* s, int len, char* out, int out_size, const char*, bool*)
+	{
+		auto r = 0;
+		for (auto i = 0; i < len; ++i)
+		{
+			const auto v = uint32_t(s[i]);
+			const auto extra = v >= 0x10000 ? 3 : v >= 0x800 ? 2 : v >= 0x80 ? 1 : 0;
+			if (out_size != 0)
+			{
+				if (r + extra >= out_size) return 0;
+				out[r] = char(extra == 0 ? v : uint8_t(0xf0 << (3 - extra)) | v >> 6 * extra);
+				for (auto j = 1; j <= extra; ++j)
+				{
+					out[r + j] = char(0x80 | (v >> 6 * (extra - j) & 0x3f));
+				}
+			}
+			r += extra + 1;
+		}
+		return r;
+	}
+	#endif
+
 	const std::string& utf8(const std::string& s, bool fast_mode)
 	{
 		return s;
@@ -98,6 +145,7 @@ namespace utils
 		}
 		else
 		{
+			#ifdef _WIN32
 			auto r = MultiByteToWideChar(CP_UTF8, 0, text, int(len), &ret[0], int(ret.capacity()));
 			if (r == 0)
 			{
@@ -106,6 +154,9 @@ namespace utils
 			}
 			ret[r] = '\0';
 			((size_t*)&ret)[2] = size_t(r);
+			#else
+			ret = utf16(text, len, false);
+			#endif
 		}
 	}
 
@@ -126,6 +177,7 @@ namespace utils
 		}
 		else
 		{
+			#ifdef _WIN32
 			auto r = WideCharToMultiByte(CP_UTF8, 0, text, int(len), &ret[0], int(ret.capacity()), nullptr, nullptr);
 			if (r == 0)
 			{
@@ -134,6 +186,9 @@ namespace utils
 			}
 			ret[r] = '\0';
 			((size_t*)&ret)[2] = size_t(r);
+			#else
+			ret = utf8(text, len, false);
+			#endif
 		}
 	}
 
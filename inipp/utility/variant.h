@@ -420,91 +420,40 @@ namespace utils
 		template <typename T>
 		T as(size_t i = 0) const
 		{
-			const auto s = size();
-			return T::deserialize(s > i ? s - i : 0ULL, [&](size_t j) { return at(i + j); });
-		}
-
-		template <>
-		variant as(size_t i) const
-		{
-			if (i == 0) return *this;
-			return slice(i);
+			if constexpr (std::is_same_v<T, variant>) return i == 0 ? *this : slice(i);
+			else if constexpr (std::is_same_v<T, bool>) return as_bool(i);
+			else if constexpr (std::is_same_v<T, int32_t>) return int32_t(as_int64_t(i));
+			else if constexpr (std::is_same_v<T, uint32_t>) return uint32_t(as_uint64_t(i));
+			else if constexpr (std::is_same_v<T, long>) return long(as_int64_t(i));
+			else if constexpr (std::is_same_v<T, unsigned long>) return (unsigned long)as_uint64_t(i);
+			else if constexpr (std::is_same_v<T, int64_t>) return as_int64_t(i);
+			else if constexpr (std::is_same_v<T, uint64_t>) return as_uint64_t(i);
+			else if constexpr (std::is_same_v<T, float>) return as_float(i);
+			else if constexpr (std::is_same_v<T, double>) return as_double(i);
+			else if constexpr (std::is_same_v<T, str_view>) return at(i);
+			else if constexpr (std::is_same_v<T, std::string>) return as_string(i);
+			else if constexpr (std::is_same_v<T, std::wstring>) return as_wstring(i);
+			else if constexpr (std::is_same_v<T, path>) return path(as_string(i));
+			#ifndef USE_SIMPLE
+			else if constexpr (std::is_same_v<T, uint2>) return as_uint2(i);
+			else if constexpr (std::is_same_v<T, uint3>) return as_uint3(i);
+			else if constexpr (std::is_same_v<T, uint4>) return as_uint4(i);
+			else if constexpr (std::is_same_v<T, float2>) return as_float2(i);
+			else if constexpr (std::is_same_v<T, float3>) return as_float3(i);
+			else if constexpr (std::is_same_v<T, float4>) return as_float4(i);
+			else if constexpr (std::is_same_v<T, int2>) return as_int2(i);
+			else if constexpr (std::is_same_v<T, int3>) return as_int3(i);
+			else if constexpr (std::is_same_v<T, int4>) return as_int4(i);
+			else if constexpr (std::is_same_v<T, rgb>) return as_rgbm(i).to_rgb();
+			else if constexpr (std::is_same_v<T, rgbm>) return as_rgbm(i);
+			#endif
+			else
+			{
+				const auto s = size();
+				return T::deserialize(s > i ? s - i : 0ULL, [&](size_t j) { return at(i + j); });
+			}
 		}
 
-		template <>
-		bool as(size_t i) const { return as_bool(i); }
-
-		template <>
-		int32_t as(size_t i) const { return int32_t(as_int64_t(i)); }
-
-		template <>
-		uint32_t as(size_t i) const { return uint32_t(as_uint64_t(i)); }
-
-		template <>
-		long as(size_t i) const { return long(as_int64_t(i)); }
-
-		template <>
-		unsigned long as(size_t i) const { return unsigned long(as_uint64_t(i)); }
-
-		template <>
-		int64_t as(size_t i) const { return as_int64_t(i); }
-
-		template <>
-		uint64_t as(size_t i) const { return as_uint64_t(i); }
-
-		template <>
-		float as(size_t i) const { return as_float(i); }
-
-		template <>
-		double as(size_t i) const { return as_double(i); }
-
-		template <>
-		str_view as(size_t i) const { return at(i); }
-
-		template <>
-		std::string as(size_t i) const { return as_string(i); }
-
-		template <>
-		std::wstring as(size_t i) const { return as_wstring(i); }
-
-		template <>
-		path as(size_t i) const { return path(as_string(i)); }
-
-		#ifndef USE_SIMPLE
-		template <>
-		uint2 as(size_t i) const { return as_uint2(i); }
-
-		template <>
-		uint3 as(size_t i) const { return as_uint3(i); }
-
-		template <>
-		uint4 as(size_t i) const { return as_uint4(i); }
-
-		template <>
-		float2 as(size_t i) const { return as_float2(i); }
-
-		template <>
-		float3 as(size_t i) const { return as_float3(i); }
-
-		template <>
-		float4 as(size_t i) const { return as_float4(i); }
-
-		template <>
-		int2 as(size_t i) const { return as_int2(i); }
-
-		template <>
-		int3 as(size_t i) const { return as_int3(i); }
-
-		template <>
-		int4 as(size_t i) const { return as_int4(i); }
-
-		template <>
-		rgb as(size_t i) const { return as_rgbm(i).to_rgb(); }
-
-		template <>
-		rgbm as(size_t i) const { return as_rgbm(i); }
-		#endif
-
 	private:
 		bool as_bool(size_t i) const;
 		uint64_t as_uint64_t(size_t i) const;